@@ -0,0 +1,95 @@
+#pragma once
+#include <atomic>
+
+// tiles each list of a frame holds, a little over a display frame at 48kHz
+#define ACTIVITY_LIST_LENGTH 1024
+
+// reads between offers of a frame to the display
+#define ACTIVITY_OFFER_SAMPLES 256
+
+// tiles marked by the audio path, in order, repeats of the last tile dropped
+struct ActivityList
+{
+    int tiles[ACTIVITY_LIST_LENGTH];
+    int count = 0;
+
+    void add(int i)
+    {
+        if (count == 0 || (tiles[count - 1] != i && count < ACTIVITY_LIST_LENGTH))
+            tiles[count++] = i;
+    }
+};
+
+// what the display needs to light up the tiles read and written since the last frame
+struct ActivityFrame
+{
+    ActivityList writes;
+    ActivityList reads;
+    ActivityList ringReads; // cursors a whole read ring was summed around
+
+    int ringRadius = 0;
+    int readLength = 0;
+
+    void clear()
+    {
+        writes.count = reads.count = ringReads.count = 0;
+    }
+};
+
+/*
+    Hands ActivityFrames from the audio thread to the display without locks,
+    as a triple buffer. The audio thread fills its back frame and offers it by
+    swapping it with the middle one, but only once the display has taken the
+    last offer, so nothing is lost when the display falls behind. The display
+    swaps its front frame with the middle one when an offer is waiting.
+*/
+
+struct ActivityChannel
+{
+    static const int FRESH = 4;
+
+    ActivityFrame frames[3];
+    int back = 0;
+    int front = 1;
+    std::atomic<int> middle;
+    int sinceOffer = 0;
+
+    ActivityChannel() : middle(2)
+    {
+    }
+
+    // audio thread
+
+    ActivityFrame &frame()
+    {
+        return frames[back];
+    }
+
+    bool offerDue()
+    {
+        return ++sinceOffer >= ACTIVITY_OFFER_SAMPLES;
+    }
+
+    void offer()
+    {
+        sinceOffer = 0;
+
+        // the display hasn't taken the last one, keep adding to this one
+        if (middle.load(std::memory_order_relaxed) & FRESH)
+            return;
+
+        back = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+        frames[back].clear();
+    }
+
+    // display thread, the newest frame or nullptr if none was offered since
+
+    const ActivityFrame *take()
+    {
+        if (!(middle.load(std::memory_order_acquire) & FRESH))
+            return nullptr;
+
+        front = middle.exchange(front, std::memory_order_acq_rel) & ~FRESH;
+        return &frames[front];
+    }
+};
@@ -0,0 +1,808 @@
+#pragma once
+#include "Hex.hpp"
+#include "BufferTransform.hpp"
+#include "JobPool.hpp"
+#include "Wav.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// chunk copies in flight between the audio thread and the disk, each way,
+// but for a save, which has room for all of them
+#define STORE_SLOTS 8
+
+// longest the UI thread waits for the audio thread to copy a save's chunks out
+#define STORE_COPY_WAIT_MS 250
+
+// dirty flags the audio thread looks through per sample while saving
+#define STORE_SCAN 64
+
+#define STORE_MAGIC 0x42584548 // "HEXB"
+#define STORE_VERSION 1
+
+/*
+    What a buffer file holds, at its start. Chunks follow at a fixed stride,
+    voice by voice, each a 32-bit byte count and that many bytes, so any
+    chunk can be rewritten in place. Numbers are in the writer's byte order.
+*/
+
+struct StoreLayout
+{
+    uint32_t magic = STORE_MAGIC;
+    uint32_t version = STORE_VERSION;
+    int32_t radius = 0;
+    int32_t format = 0;
+    int32_t voices = 0;
+    int32_t chunks = 0;
+    int32_t stride = 0;
+
+    bool operator==(const StoreLayout &other) const
+    {
+        return magic == other.magic && version == other.version && radius == other.radius && format == other.format &&
+               voices == other.voices && chunks == other.chunks && stride == other.stride;
+    }
+
+    bool operator!=(const StoreLayout &other) const
+    {
+        return !(*this == other);
+    }
+
+    long offset(int voice, int chunk) const
+    {
+        return long(sizeof(StoreLayout)) + (long(voice) * chunks + chunk) * stride;
+    }
+};
+
+// one chunk on its way to or from the disk
+struct StoreSlot
+{
+    enum Kind
+    {
+        CHUNK,
+        BEGIN, // data holds the StoreLayout
+        END,
+        ABORT // an end before every chunk was copied
+    };
+
+    Kind kind = CHUNK;
+    bool rewrite = false; // at BEGIN, every chunk follows for a new file
+    int voice = 0;
+    int chunk = 0;
+    int bytes = 0;
+    std::vector<char> data;
+};
+
+// single producer, single consumer, of slots allocated up front
+struct SlotRing
+{
+    std::vector<StoreSlot> slots;
+    std::atomic<int> head{0}; // slots pushed, only moved by the producer
+    std::atomic<int> tail{0}; // slots popped, only moved by the consumer
+
+    // at least count slots of bytes each, kept for later jobs
+    void reserve(int bytes, int count = STORE_SLOTS)
+    {
+        if ((int)slots.size() < count)
+            slots.resize(count);
+        for (StoreSlot &slot : slots)
+            slot.data.resize(std::max(bytes, (int)sizeof(StoreLayout)));
+    }
+
+    void clear()
+    {
+        head = tail = 0;
+    }
+
+    // producer, the next free slot or nullptr if all are in flight
+    StoreSlot *back()
+    {
+        int h = head.load(std::memory_order_relaxed);
+        return h - tail.load(std::memory_order_acquire) < (int)slots.size() ? &slots[h % slots.size()] : nullptr;
+    }
+
+    void push()
+    {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // consumer, the oldest pushed slot or nullptr if none
+    StoreSlot *front()
+    {
+        int t = tail.load(std::memory_order_relaxed);
+        return t < head.load(std::memory_order_acquire) ? &slots[t % slots.size()] : nullptr;
+    }
+
+    void pop()
+    {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+};
+
+/*
+    Saves a module's hexes to a binary file and loads them back, without the
+    audio thread ever waiting on the disk.
+
+    A save starts on the UI thread, which queues a job on the JobPool. The
+    audio thread then walks the hexes' dirty chunks a few flags per sample,
+    copies each into a free slot, and the worker writes it into a copy of the
+    last file at its offset. There is a slot for every chunk, so the copies
+    take a few milliseconds of audio however slow the disk, and the worker
+    finishes writing on its own. The first save, and any after the voices or
+    sample format change, copies every chunk into a new file instead. Either
+    way the file replaces the old one only once complete, so a patch archived
+    mid-save holds a whole buffer, the one last saved.
+
+    A load reads the layout on the UI thread, then the worker streams chunks
+    in and the audio thread copies one into its hex per sample, so the patch
+    opens at once and the buffers fill in over the next few moments. Chunks
+    load as they were saved, into hexes in the file's sample format.
+
+    A save asked for while one is still running is left for the next one,
+    and chunks it would have written stay dirty until then.
+
+    WAV export walks every chunk the same way, copied out as volts without
+    touching what is dirty, and the worker writes a channel per voice. WAV
+    import decodes, resamples and fills new hexes on the worker, then hands
+    them over in imported for the audio thread to swap in.
+
+    A transform gathers the volts as an export does, and the worker fills
+    shadow hexes with the result. The audio thread then trades buffers with
+    them between samples, so what was written while the job ran is lost.
+    A change of sample format gathers them too, and the worker fills new
+    hexes in the new format, which the audio thread swaps in as an import.
+*/
+
+struct BufferStore
+{
+    enum State
+    {
+        IDLE,
+        SAVING,       // the audio thread copies chunks out
+        FLUSHING,     // the worker finishes with them
+        LOADING,
+        EXPORTING,    // the audio thread copies volts out
+        IMPORTING,    // the worker fills imported
+        IMPORTED,     // imported is ready to swap in
+        TRANSFORMING, // copies volts out as EXPORTING does
+        TRANSFORMED   // imported holds shadow hexes to trade buffers with
+    };
+
+    std::atomic<int> state{IDLE};
+    std::atomic<bool> cancelled{false};
+    std::atomic<bool> saveFailed{false}; // so the next save writes every chunk
+    std::atomic<bool> working{false};    // a job is queued or running
+
+    // the UI and upkeep threads both start jobs, one at a time
+    std::mutex starting;
+
+    // worker, then the audio thread once IMPORTED or TRANSFORMED
+    std::vector<std::unique_ptr<Hex>> imported;
+    SampleFormat importedFormat = FLOAT_SAMPLES;
+
+    SlotRing toDisk;
+    SlotRing fromDisk;
+
+    // audio thread
+    StoreLayout savedLayout; // of the file as it was last written or read
+    StoreLayout walkLayout;
+    bool walking = false;
+    bool walkAll = false;
+    int walkVoice = 0;
+    int walkChunk = 0;
+
+    ~BufferStore()
+    {
+        stop();
+    }
+
+    // UI thread, waits for the job to finish or give up. A save already
+    // copied out needs no audio to finish, and is written rather than lost.
+    void stop()
+    {
+        if (state.load(std::memory_order_acquire) != FLUSHING)
+        {
+            cancelled = true;
+            if (JobPool::shared().cancel(this))
+                working = false;
+        }
+        finish();
+        cancelled = false;
+    }
+
+    // UI thread, waits for the last job to return
+    void finish()
+    {
+        while (working.load(std::memory_order_acquire))
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    void start(std::function<void()> job)
+    {
+        finish();
+        working = true;
+        JobPool::shared().run(this, [=]()
+                              {
+                                  job();
+                                  working.store(false, std::memory_order_release);
+                              });
+    }
+
+    static StoreLayout layoutOf(const std::vector<std::unique_ptr<Hex>> &hexes, SampleFormat format)
+    {
+        StoreLayout layout;
+        layout.radius = hexes[0]->radius;
+        layout.format = format;
+        layout.voices = hexes.size();
+        layout.chunks = hexes[0]->chunkCount();
+        layout.stride = sizeof(int32_t) + hexes[0]->chunkBytes();
+        return layout;
+    }
+
+    // UI thread, with room for maxChunks, returns false if the last save or
+    // load is still running
+    bool save(const std::string &path, int maxChunkBytes, int maxChunks)
+    {
+        std::lock_guard<std::mutex> lock(starting);
+        if (state.load(std::memory_order_acquire) != IDLE)
+            return false;
+        finish();
+
+        toDisk.reserve(maxChunkBytes, maxChunks + 2); // and its BEGIN and END
+        toDisk.clear();
+        state.store(SAVING, std::memory_order_release);
+        start(std::bind(&BufferStore::writeFile, this, path));
+        return true;
+    }
+
+    // UI thread, every voice's buffer to a WAV file at sampleRate
+    bool exportWav(const std::string &path, float sampleRate, int maxChunkBytes)
+    {
+        std::lock_guard<std::mutex> lock(starting);
+        if (state.load(std::memory_order_acquire) != IDLE)
+            return false;
+        finish();
+
+        toDisk.reserve(maxChunkBytes);
+        toDisk.clear();
+        state.store(EXPORTING, std::memory_order_release);
+        start(std::bind(&BufferStore::writeWav, this, path, sampleRate));
+        return true;
+    }
+
+    /*
+        UI thread, a WAV file resampled to sampleRate into new hexes in format
+        from createHex, voice by voice from the file's channels up to maxVoices.
+    */
+    bool importWav(const std::string &path, float sampleRate, int maxVoices, Hex *(*createHex)(SampleFormat), SampleFormat format)
+    {
+        std::lock_guard<std::mutex> lock(starting);
+        if (state.load(std::memory_order_acquire) != IDLE)
+            return false;
+        finish();
+
+        imported.clear();
+        importedFormat = format;
+        state.store(IMPORTING, std::memory_order_release);
+        start(std::bind(&BufferStore::readWav, this, path, sampleRate, maxVoices, createHex));
+        return true;
+    }
+
+    // UI thread, every voice's buffer through transform into shadow hexes from
+    // createHex, with room for maxVoices
+    bool transform(BufferTransform transform, int maxChunkBytes, int maxVoices, Hex *(*createHex)(SampleFormat))
+    {
+        std::lock_guard<std::mutex> lock(starting);
+        if (state.load(std::memory_order_acquire) != IDLE)
+            return false;
+        finish();
+
+        imported.clear();
+        toDisk.reserve(maxChunkBytes);
+        toDisk.clear();
+        state.store(TRANSFORMING, std::memory_order_release);
+        start(std::bind(&BufferStore::transformVolts, this, transform, maxVoices, createHex, std::random_device()()));
+        return true;
+    }
+
+    // upkeep thread, every voice's buffer into new hexes in format from
+    // createHex, with room for maxVoices so the swap doesn't allocate
+    bool convert(SampleFormat format, int maxChunkBytes, int maxVoices, Hex *(*createHex)(SampleFormat))
+    {
+        std::lock_guard<std::mutex> lock(starting);
+        if (state.load(std::memory_order_acquire) != IDLE)
+            return false;
+        finish();
+
+        imported.clear();
+        toDisk.reserve(maxChunkBytes);
+        toDisk.clear();
+        state.store(TRANSFORMING, std::memory_order_release);
+        start(std::bind(&BufferStore::convertVolts, this, format, maxVoices, createHex));
+        return true;
+    }
+
+    // audio thread, true once the hexes of an import are ready in imported
+    bool importReady()
+    {
+        return state.load(std::memory_order_acquire) == IMPORTED;
+    }
+
+    // audio thread, true once imported holds the shadow hexes of a transform
+    bool transformReady()
+    {
+        return state.load(std::memory_order_acquire) == TRANSFORMED;
+    }
+
+    // audio thread, after taking imported from an import or transform
+    void importTaken()
+    {
+        state.store(IDLE, std::memory_order_release);
+    }
+
+    // UI thread, false if the audio thread still copies a save's chunks out after milliseconds
+    bool waitCopied(int milliseconds)
+    {
+        for (int waited = 0; state.load(std::memory_order_acquire) == SAVING; waited++)
+        {
+            if (waited >= milliseconds)
+                return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return true;
+    }
+
+    // the layout at the start of the file at path, false if there is none
+    static bool readLayout(const std::string &path, StoreLayout &layout)
+    {
+        FILE *file = std::fopen(path.c_str(), "rb");
+        if (!file)
+            return false;
+        bool read = std::fread(&layout, sizeof(layout), 1, file) == 1 && layout.magic == STORE_MAGIC &&
+                    layout.version == STORE_VERSION && layout.format >= 0 && layout.format < SAMPLE_FORMATS_LEN &&
+                    layout.voices > 0 && layout.chunks > 0 && layout.stride > (int)sizeof(int32_t);
+        std::fclose(file);
+        return read;
+    }
+
+    /*
+        UI thread, before the module processes, into hexes in the format of
+        the layout readLayout found at path. Streams the chunks once the
+        audio thread runs, or returns false if there is no file.
+    */
+    bool load(const std::string &path, const StoreLayout &layout)
+    {
+        std::lock_guard<std::mutex> lock(starting);
+        if (state.load(std::memory_order_acquire) != IDLE)
+            return false;
+        finish();
+
+        savedLayout = layout;
+        fromDisk.reserve(layout.stride - sizeof(int32_t));
+        fromDisk.clear();
+        state.store(LOADING, std::memory_order_release);
+        start(std::bind(&BufferStore::readFile, this, path, layout));
+        return true;
+    }
+
+    // audio thread, every sample, hexes as they are now
+    void process(const std::vector<std::unique_ptr<Hex>> &hexes, SampleFormat format)
+    {
+        int s = state.load(std::memory_order_acquire);
+        if (s == SAVING)
+            copyOut(hexes, format);
+        else if (s == LOADING)
+            copyIn(hexes, format);
+        else if (s == EXPORTING || s == TRANSFORMING)
+            copyVolts(hexes, format);
+    }
+
+    void copyOut(const std::vector<std::unique_ptr<Hex>> &hexes, SampleFormat format)
+    {
+        StoreSlot *slot = toDisk.back();
+        if (!slot)
+            return;
+
+        if (!walking)
+        {
+            walkLayout = layoutOf(hexes, format);
+            walkAll = walkLayout != savedLayout || saveFailed.exchange(false);
+
+            // slots were sized for float samples, any chunk must fit them
+            if (walkLayout.stride - (int)sizeof(int32_t) > (int)slot->data.size())
+            {
+                saveFailed = true;
+                slot->kind = StoreSlot::END;
+                toDisk.push();
+                state.store(FLUSHING, std::memory_order_release);
+                return;
+            }
+
+            walkVoice = walkChunk = 0;
+            walking = true;
+
+            slot->kind = StoreSlot::BEGIN;
+            slot->rewrite = walkAll;
+            std::memcpy(slot->data.data(), &walkLayout, sizeof(walkLayout));
+            toDisk.push();
+            return;
+        }
+
+        // the hexes were rebuilt or voices added, this save is for the old ones
+        if (layoutOf(hexes, format) != walkLayout)
+        {
+            saveFailed = true;
+            walkVoice = walkLayout.voices;
+        }
+
+        for (int scanned = 0; walkVoice < walkLayout.voices && scanned < STORE_SCAN; scanned++)
+        {
+            int voice = walkVoice, c = walkChunk;
+            if (++walkChunk == walkLayout.chunks)
+            {
+                walkChunk = 0;
+                walkVoice++;
+            }
+
+            Hex *hex = hexes[voice].get();
+            if (walkAll || hex->dirtyChunks[c])
+            {
+                slot->kind = StoreSlot::CHUNK;
+                slot->voice = voice;
+                slot->chunk = c;
+                slot->bytes = hex->saveChunk(c, slot->data.data());
+                toDisk.push();
+                return;
+            }
+        }
+
+        if (walkVoice == walkLayout.voices)
+        {
+            slot->kind = StoreSlot::END;
+            toDisk.push();
+            savedLayout = walkLayout;
+            walking = false;
+            state.store(FLUSHING, std::memory_order_release);
+        }
+    }
+
+    // copyOut for export, every chunk in volts and nothing marked saved
+    void copyVolts(const std::vector<std::unique_ptr<Hex>> &hexes, SampleFormat format)
+    {
+        StoreSlot *slot = toDisk.back();
+        if (!slot)
+            return;
+
+        if (!walking)
+        {
+            walkLayout = layoutOf(hexes, format);
+            walkVoice = walkChunk = 0;
+            walking = true;
+
+            slot->kind = StoreSlot::BEGIN;
+            std::memcpy(slot->data.data(), &walkLayout, sizeof(walkLayout));
+            toDisk.push();
+            return;
+        }
+
+        StoreLayout layout = layoutOf(hexes, format);
+        if (walkVoice == walkLayout.voices || layout.chunks != walkLayout.chunks || layout.voices < walkLayout.voices)
+        {
+            slot->kind = walkVoice == walkLayout.voices ? StoreSlot::END : StoreSlot::ABORT;
+            toDisk.push();
+            walking = false;
+            state.store(FLUSHING, std::memory_order_release);
+            return;
+        }
+
+        slot->kind = StoreSlot::CHUNK;
+        slot->voice = walkVoice;
+        slot->chunk = walkChunk;
+        slot->bytes = hexes[walkVoice]->copyChunk(walkChunk, reinterpret_cast<float *>(slot->data.data())) * sizeof(float);
+        toDisk.push();
+
+        if (++walkChunk == walkLayout.chunks)
+        {
+            walkChunk = 0;
+            walkVoice++;
+        }
+    }
+
+    void copyIn(const std::vector<std::unique_ptr<Hex>> &hexes, SampleFormat format)
+    {
+        StoreSlot *slot = fromDisk.front();
+        if (!slot)
+            return;
+
+        // the hexes are made in the file's format, only ones replaced
+        // meanwhile could turn its chunks away
+        if (slot->kind == StoreSlot::END)
+            state.store(IDLE, std::memory_order_release);
+        else if (format == savedLayout.format && slot->voice < (int)hexes.size())
+            hexes[slot->voice]->loadChunk(slot->chunk, slot->data.data(), slot->bytes);
+        fromDisk.pop();
+    }
+
+    // worker, waits for the other side of a ring, false if cancelled
+    bool wait()
+    {
+        if (cancelled.load(std::memory_order_relaxed))
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        return true;
+    }
+
+    void writeFile(std::string path)
+    {
+        std::string newPath = path + ".new";
+        StoreLayout layout;
+        FILE *file = nullptr;
+        bool all = false;
+        bool failed = false;
+
+        while (true)
+        {
+            StoreSlot *slot = toDisk.front();
+            if (!slot)
+            {
+                if (wait())
+                    continue;
+                failed = true;
+                break;
+            }
+
+            if (slot->kind == StoreSlot::BEGIN)
+            {
+                std::memcpy(&layout, slot->data.data(), sizeof(layout));
+                all = slot->rewrite;
+                file = all || copyFile(path, newPath) ? std::fopen(newPath.c_str(), all ? "wb" : "r+b") : nullptr;
+                failed = !file || (all && std::fwrite(&layout, sizeof(layout), 1, file) != 1);
+            }
+            else if (slot->kind == StoreSlot::CHUNK && !failed)
+            {
+                int32_t bytes = slot->bytes;
+                failed = std::fseek(file, layout.offset(slot->voice, slot->chunk), SEEK_SET) ||
+                         std::fwrite(&bytes, sizeof(bytes), 1, file) != 1 ||
+                         std::fwrite(slot->data.data(), 1, bytes, file) != size_t(bytes);
+            }
+
+            bool end = slot->kind == StoreSlot::END;
+            toDisk.pop();
+            if (end)
+                break;
+        }
+
+        if (file && std::fclose(file))
+            failed = true;
+        if (!failed)
+        {
+            std::remove(path.c_str());
+            failed = std::rename(newPath.c_str(), path.c_str()) != 0;
+        }
+        if (failed)
+        {
+            std::remove(newPath.c_str());
+            saveFailed = true;
+        }
+
+        state.store(IDLE, std::memory_order_release);
+    }
+
+    // worker, the chunks copyVolts sends and their layout, false if it was cut short
+    bool gather(std::vector<HexVolts> &voices, StoreLayout &layout)
+    {
+        while (true)
+        {
+            StoreSlot *slot = toDisk.front();
+            if (!slot)
+            {
+                if (wait())
+                    continue;
+                break;
+            }
+
+            if (slot->kind == StoreSlot::BEGIN)
+            {
+                std::memcpy(&layout, slot->data.data(), sizeof(layout));
+                voices.resize(layout.voices);
+            }
+            else if (slot->kind == StoreSlot::CHUNK)
+            {
+                const float *v = reinterpret_cast<const float *>(slot->data.data());
+                HexVolts &voice = voices[slot->voice];
+                voice.volts.insert(voice.volts.end(), v, v + slot->bytes / sizeof(float));
+                voice.chunkSizes.push_back(slot->bytes / sizeof(float));
+            }
+
+            StoreSlot::Kind kind = slot->kind;
+            toDisk.pop();
+            if (kind == StoreSlot::END || kind == StoreSlot::ABORT)
+                return kind == StoreSlot::END;
+        }
+        return false;
+    }
+
+    void writeWav(std::string path, float sampleRate)
+    {
+        std::vector<HexVolts> voices;
+        StoreLayout layout;
+        if (gather(voices, layout) && !voices.empty())
+        {
+            Wav wav;
+            wav.channels = voices.size();
+            wav.sampleRate = std::lround(sampleRate);
+
+            size_t frames = 0;
+            for (const HexVolts &voice : voices)
+                frames = std::max(frames, voice.volts.size());
+            wav.samples.assign(frames * wav.channels, 0.f);
+
+            // voices of grains that were resized run short, and end in silence
+            for (int c = 0; c < wav.channels; c++)
+            {
+                for (size_t i = 0; i < voices[c].volts.size(); i++)
+                    wav.samples[i * wav.channels + c] = voices[c].volts[i] / WAV_VOLTS;
+            }
+
+            std::string error;
+            wav.save(path, error);
+        }
+
+        state.store(IDLE, std::memory_order_release);
+    }
+
+    void readWav(std::string path, float sampleRate, int maxVoices, Hex *(*createHex)(SampleFormat))
+    {
+        Wav wav;
+        std::string error;
+        if (wav.load(path, error))
+        {
+            std::unique_ptr<Hex> first(createHex(importedFormat));
+            wav.resample(std::lround(sampleRate), first->fillLength());
+
+            int voices = std::min(wav.channels, maxVoices);
+            imported.reserve(maxVoices);
+            imported.push_back(std::move(first));
+            while ((int)imported.size() < voices)
+                imported.push_back(std::unique_ptr<Hex>(createHex(importedFormat)));
+
+            for (int v = 0; v < voices && !cancelled.load(std::memory_order_relaxed); v++)
+            {
+                std::vector<float> volts = wav.channel(v, WAV_VOLTS);
+                imported[v]->fill(volts.data(), volts.size());
+            }
+        }
+
+        bool ready = !imported.empty() && !cancelled.load(std::memory_order_relaxed);
+        state.store(ready ? IMPORTED : IDLE, std::memory_order_release);
+    }
+
+    void transformVolts(BufferTransform transform, int maxVoices, Hex *(*createHex)(SampleFormat), uint32_t seed)
+    {
+        std::vector<HexVolts> voices;
+        StoreLayout layout;
+        bool ready = gather(voices, layout);
+        importedFormat = (SampleFormat)layout.format;
+        ready = ready && fillHexes(voices, maxVoices, createHex, transform, seed);
+        state.store(ready ? TRANSFORMED : IDLE, std::memory_order_release);
+    }
+
+    // transformVolts without the transform, into hexes to swap in whole
+    void convertVolts(SampleFormat format, int maxVoices, Hex *(*createHex)(SampleFormat))
+    {
+        std::vector<HexVolts> voices;
+        StoreLayout layout;
+        bool ready = gather(voices, layout);
+        importedFormat = format;
+        ready = ready && fillHexes(voices, maxVoices, createHex, BUFFER_TRANSFORMS_LEN, 0);
+        state.store(ready ? IMPORTED : IDLE, std::memory_order_release);
+    }
+
+    // imported, a hex in importedFormat per voice with room for maxVoices, through
+    // transform unless it is BUFFER_TRANSFORMS_LEN
+    bool fillHexes(std::vector<HexVolts> &voices, int maxVoices, Hex *(*createHex)(SampleFormat), int transform, uint32_t seed)
+    {
+        imported.reserve(maxVoices);
+        for (HexVolts &voice : voices)
+        {
+            std::unique_ptr<Hex> hex(createHex(importedFormat));
+            if ((int)voice.chunkSizes.size() != hex->chunkCount() || cancelled.load(std::memory_order_relaxed))
+            {
+                imported.clear();
+                return false;
+            }
+
+            // the same seed shuffles every voice alike
+            if (transform < BUFFER_TRANSFORMS_LEN)
+                VoltsTransformer(voice, *hex).apply((BufferTransform)transform, seed);
+
+            const float *volts = voice.volts.data();
+            for (int c = 0; c < hex->chunkCount(); c++)
+            {
+                hex->fillChunk(c, volts, voice.chunkSizes[c]);
+                volts += voice.chunkSizes[c];
+            }
+            imported.push_back(std::move(hex));
+        }
+        return !voices.empty();
+    }
+
+    static bool copyFile(const std::string &from, const std::string &to)
+    {
+        FILE *in = std::fopen(from.c_str(), "rb");
+        if (!in)
+            return false;
+        FILE *out = std::fopen(to.c_str(), "wb");
+        bool copied = out != nullptr;
+
+        char buffer[1 << 16];
+        size_t bytes;
+        while (copied && (bytes = std::fread(buffer, 1, sizeof(buffer), in)) > 0)
+            copied = std::fwrite(buffer, 1, bytes, out) == bytes;
+        copied = copied && !std::ferror(in);
+
+        std::fclose(in);
+        if (out && std::fclose(out))
+            copied = false;
+        return copied;
+    }
+
+    void readFile(std::string path, StoreLayout layout)
+    {
+        FILE *file = std::fopen(path.c_str(), "rb");
+
+        for (int voice = 0; file && voice < layout.voices; voice++)
+        {
+            for (int chunk = 0; chunk < layout.chunks; chunk++)
+            {
+                StoreSlot *slot;
+                while (!(slot = fromDisk.back()))
+                {
+                    if (!wait())
+                    {
+                        std::fclose(file);
+                        state.store(IDLE, std::memory_order_release);
+                        return;
+                    }
+                }
+
+                int32_t bytes = 0;
+                if (std::fseek(file, layout.offset(voice, chunk), SEEK_SET) ||
+                    std::fread(&bytes, sizeof(bytes), 1, file) != 1)
+                    bytes = 0;
+
+                // never written, the hex already holds zeros
+                if (bytes <= 0 || bytes > layout.stride - (int)sizeof(int32_t))
+                    continue;
+                if (std::fread(slot->data.data(), 1, bytes, file) != size_t(bytes))
+                    continue;
+
+                slot->kind = StoreSlot::CHUNK;
+                slot->voice = voice;
+                slot->chunk = chunk;
+                slot->bytes = bytes;
+                fromDisk.push();
+            }
+        }
+
+        if (file)
+            std::fclose(file);
+
+        StoreSlot *slot;
+        while (!(slot = fromDisk.back()))
+        {
+            if (!wait())
+            {
+                state.store(IDLE, std::memory_order_release);
+                return;
+            }
+        }
+        slot->kind = StoreSlot::END;
+        fromDisk.push();
+    }
+};
@@ -0,0 +1,179 @@
+#pragma once
+#include "Hex.hpp"
+
+#include <random>
+
+// peak of a normalized buffer
+#define NORMALIZE_VOLTS 5.f
+
+// how much of its neighbour each tile takes on in a smear
+#define SMEAR_AMOUNT .5f
+
+// whole-buffer changes from the context menu, in the order it lists them
+enum BufferTransform
+{
+    CLEAR_BUFFER,
+    REVERSE_BUFFER,
+    NORMALIZE_BUFFER,
+    SHUFFLE_TILES,
+    SMEAR_X,
+    SMEAR_Y,
+    SMEAR_Z,
+    FADE_TO_EDGE,
+    FADE_TO_CENTER,
+    BUFFER_TRANSFORMS_LEN
+};
+
+// a hex's buffer as Hex::copyChunk gives it, chunk after chunk
+struct HexVolts
+{
+    std::vector<float> volts;
+    std::vector<int> chunkSizes;
+};
+
+/*
+    Transforms a buffer gathered from a hex like shape, tile by tile, on a
+    worker. A tile is a sample of a Hex and a whole grain of a GrainHex, so
+    shuffling moves grains about whole and a smear blends each grain into the
+    next along the axis, sample by sample.
+*/
+
+struct VoltsTransformer
+{
+    HexVolts &buffer;
+    Hex &shape;
+    std::vector<int> starts; // of each tile's volts, then the end of the last
+
+    VoltsTransformer(HexVolts &buffer, Hex &shape) : buffer(buffer), shape(shape)
+    {
+        int start = 0;
+        for (int n : buffer.chunkSizes)
+        {
+            if (shape.chunkTiles() == 1)
+                starts.push_back(start);
+            else
+                for (int i = 0; i < n; i++)
+                    starts.push_back(start + i);
+            start += n;
+        }
+        starts.push_back(start);
+    }
+
+    int tiles()
+    {
+        return starts.size() - 1;
+    }
+
+    int tileSize(int i)
+    {
+        return starts[i + 1] - starts[i];
+    }
+
+    void apply(BufferTransform transform, uint32_t seed)
+    {
+        std::vector<float> &v = buffer.volts;
+        switch (transform)
+        {
+        case CLEAR_BUFFER:
+            std::fill(v.begin(), v.end(), 0.f);
+            break;
+        case REVERSE_BUFFER:
+        {
+            std::vector<int> order(tiles());
+            for (int i = 0; i < tiles(); i++)
+                order[i] = tiles() - 1 - i;
+            reorder(order);
+            for (int i = 0; i < tiles(); i++)
+                std::reverse(v.begin() + starts[i], v.begin() + starts[i + 1]);
+            break;
+        }
+        case NORMALIZE_BUFFER:
+        {
+            float peak = 0;
+            for (float x : v)
+                peak = std::max(peak, std::fabs(x));
+            if (peak > 0)
+                scale(std::vector<float>(tiles(), NORMALIZE_VOLTS / peak));
+            break;
+        }
+        case SHUFFLE_TILES:
+        {
+            std::vector<int> order(tiles());
+            for (int i = 0; i < tiles(); i++)
+                order[i] = i;
+            std::mt19937 random(seed);
+            std::shuffle(order.begin(), order.end(), random);
+            reorder(order);
+            break;
+        }
+        case SMEAR_X:
+            return smear(1);
+        case SMEAR_Y:
+            return smear(shape.y_step);
+        case SMEAR_Z:
+            return smear(shape.z_step);
+        case FADE_TO_EDGE:
+        case FADE_TO_CENTER:
+        {
+            std::vector<float> gains(tiles());
+            float farthest = 0;
+            for (int i = 0; i < tiles(); i++)
+            {
+                gains[i] = std::hypot(shape.positions[i].x - shape.width / 2, shape.positions[i].y - shape.height / 2);
+                farthest = std::max(farthest, gains[i]);
+            }
+            for (float &gain : gains)
+                gain = transform == FADE_TO_EDGE ? 1 - gain / farthest : gain / farthest;
+            scale(gains);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    // tiles in order, each keeping its volts, and chunks their new sizes
+    void reorder(const std::vector<int> &order)
+    {
+        std::vector<float> volts;
+        std::vector<int> newStarts;
+        volts.reserve(buffer.volts.size());
+        for (int i : order)
+        {
+            newStarts.push_back(volts.size());
+            volts.insert(volts.end(), buffer.volts.begin() + starts[i], buffer.volts.begin() + starts[i + 1]);
+        }
+        newStarts.push_back(volts.size());
+
+        if (shape.chunkTiles() == 1)
+        {
+            for (int i = 0; i < tiles(); i++)
+                buffer.chunkSizes[i] = newStarts[i + 1] - newStarts[i];
+        }
+        buffer.volts.swap(volts);
+        starts.swap(newStarts);
+    }
+
+    void scale(const std::vector<float> &gains)
+    {
+        for (int i = 0; i < tiles(); i++)
+        {
+            for (int s = starts[i]; s < starts[i + 1]; s++)
+                buffer.volts[s] *= gains[i];
+        }
+    }
+
+    // each tile into the next one step along, in index order so it trails on
+    void smear(int step)
+    {
+        for (int i = 0; i < tiles(); i++)
+        {
+            int from = shape.wrap(i - step, tiles());
+            int n = std::min(tileSize(i), tileSize(from));
+            float *to = &buffer.volts[starts[i]];
+            const float *by = &buffer.volts[starts[from]];
+            for (int s = 0; s < n; s++)
+                to[s] += (by[s] - to[s]) * SMEAR_AMOUNT;
+        }
+    }
+};
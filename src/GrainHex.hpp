@@ -1,46 +1,268 @@
+#pragma once
 #include "Hex.hpp"
+#include "GrainPool.hpp"
 
 #define MIN_GRAIN_SIZE 44
-#define MAX_GRAIN_SIZE 4410
-#define AVERAGE_SIZE 128
 
-struct Grain
+// grains the read cursor may pass over at a boundary, see GrainHex::skipBelow
+#define GRAIN_SKIP_LIMIT 4
+
+// GrainAnalysis sums in fixed point with this many steps to a volt, clamped
+// to this many volts so a full pass of squares can't overflow
+#define GRAIN_ANALYSIS_BITS 24
+#define GRAIN_ANALYSIS_ONE float(1 << GRAIN_ANALYSIS_BITS)
+#define GRAIN_ANALYSIS_VOLTS 64.f
+
+// volts a grain's tile shows for brightness if it crossed zero every sample
+#define GRAIN_CROSSING_VOLTS 20.f
+
+// what a grain's tile shows of its last pass, in the order the menu lists them
+enum GrainDisplay
 {
-    float buffer[MAX_GRAIN_SIZE];
+    GRAIN_LEVEL,
+    GRAIN_PEAK,
+    GRAIN_BRIGHTNESS,
+    GRAIN_DISPLAYS_LEN
+};
+
+// levels of one full write pass of a grain
+struct GrainStats
+{
+    float meanAbs = 0;
+    float rms = 0;
+    float peak = 0;
+    int zeroCrossings = 0;
+    int count = 0; // samples in the pass
+
+    // a tile's voltage for display, brightness being how often the pass crossed zero
+    float tileVoltage(GrainDisplay display) const
+    {
+        switch (display)
+        {
+        case GRAIN_PEAK:
+            return peak;
+        case GRAIN_BRIGHTNESS:
+            return count > 0 ? GRAIN_CROSSING_VOLTS * zeroCrossings / count : 0;
+        default:
+            return meanAbs;
+        }
+    }
+};
+
+/*
+    Gathers GrainStats sample by sample as a grain is written, so they cost
+    nothing to read. last holds the stats of the most recent finished pass.
+    Sums are integers, so the block path's vectorized loop adds up to exactly
+    what the per-sample path does.
+*/
+
+struct GrainAnalysis
+{
+    int64_t sumAbs = 0;
+    int64_t sumSquares = 0;
+    float peak = 0;
+    int zeroCrossings = 0;
+    int count = 0;
+    bool negative = false; // sign of the last sample written
+
+    GrainStats last;
+
+    void add(float v)
+    {
+        float a = std::min(std::fabs(v), GRAIN_ANALYSIS_VOLTS);
+        int64_t fixed = a * GRAIN_ANALYSIS_ONE; // exact, ONE is a power of two
+        sumAbs += fixed;
+        sumSquares += (fixed * fixed) >> GRAIN_ANALYSIS_BITS;
+        peak = std::max(peak, a);
+
+        bool n = v < 0;
+        zeroCrossings += n != negative;
+        negative = n;
+
+        count++;
+    }
+
+    // at the end of a pass, starts the next one
+    void finish()
+    {
+        if (count > 0)
+        {
+            last.meanAbs = sumAbs / GRAIN_ANALYSIS_ONE / count;
+            last.rms = std::sqrt(sumSquares / GRAIN_ANALYSIS_ONE / count);
+            last.peak = peak;
+            last.zeroCrossings = zeroCrossings;
+            last.count = count;
+        }
+
+        sumAbs = sumSquares = 0;
+        peak = 0;
+        zeroCrossings = count = 0;
+    }
+};
+
+/*
+    A grain's samples live in a block from the shared GrainPool, big enough
+    for its current size. Until a grain is first written it reads the pool's
+    zeros and holds no block at all. Samples are kept as Storage, see
+    SampleStorage.hpp, and are floats everywhere outside the buffer.
+*/
+
+template <typename Storage>
+struct StoredGrain
+{
+    typedef typename Storage::Sample Sample;
+
+    Sample *buffer = static_cast<Sample *>(GrainPool::zeros());
+    int sizeClass = -1; // of buffer in the pool, -1 while on the zeros
+    int capacity = 0;
+    bool kept = false; // buffer is also a snapshot's, see StoredGrainHex::captureSnapshot
     int size = MAX_GRAIN_SIZE;
     int writeIndex = 0;
     int readIndex = 0;
 
-    float averageBuffer[AVERAGE_SIZE];
-    int averageIndex = 0;
+    GrainAnalysis analysis;
+
+    StoredGrain()
+    {
+    }
+
+    StoredGrain(StoredGrain &&other) noexcept
+        : buffer(other.buffer), sizeClass(other.sizeClass), capacity(other.capacity), kept(other.kept), size(other.size),
+          writeIndex(other.writeIndex), readIndex(other.readIndex), analysis(other.analysis)
+    {
+        other.buffer = static_cast<Sample *>(GrainPool::zeros());
+        other.sizeClass = -1;
+        other.capacity = 0;
+        other.kept = false;
+    }
+
+    StoredGrain(const StoredGrain &) = delete;
+    StoredGrain &operator=(const StoredGrain &) = delete;
+
+    ~StoredGrain()
+    {
+        if (sizeClass >= 0 && !kept)
+            GrainPool::shared().release(buffer, sizeClass);
+    }
+
+    // takes a block for the current size if still on the zeros, or a copy of
+    // one a snapshot keeps, before writing. False if the pool had none.
+    bool reserve()
+    {
+        if (sizeClass < 0)
+            return resize();
+        if (kept)
+        {
+            Sample *copy = static_cast<Sample *>(GrainPool::shared().allocate(sizeClass));
+            if (!copy)
+                return false;
+            std::copy(buffer, buffer + capacity, copy);
+            buffer = copy;
+            kept = false;
+        }
+        return true;
+    }
+
+    // moves to the block class for size, keeping what fits. Without a block
+    // from the pool the grain keeps the one it has and shrinks to fit it.
+    bool resize()
+    {
+        GrainPool &pool = GrainPool::shared();
+        int newClass = GrainPool::classFor(size * sizeof(Sample));
+        int newCapacity = GRAIN_POOL_CLASSES[newClass] / sizeof(Sample);
+        Sample *newBuffer = static_cast<Sample *>(pool.allocate(newClass));
+        if (!newBuffer)
+        {
+            if (sizeClass >= 0 && size > capacity)
+            {
+                size = capacity;
+                writeIndex %= size;
+                readIndex %= size;
+            }
+            return false;
+        }
+
+        int copied = std::min(newCapacity, sizeClass < 0 ? MAX_GRAIN_SIZE : capacity);
+        std::copy(buffer, buffer + copied, newBuffer);
+        std::fill(newBuffer + copied, newBuffer + newCapacity, Sample(0));
+
+        if (sizeClass >= 0 && !kept)
+            pool.release(buffer, sizeClass);
 
+        buffer = newBuffer;
+        sizeClass = newClass;
+        capacity = newCapacity;
+        kept = false;
+        return true;
+    }
+
+    // bytes of the block held, 0 while on the zeros
+    size_t bytes() const
+    {
+        return capacity * sizeof(Sample);
+    }
+
+    // writes are dropped while the pool has no block for the grain
     void setVoltage(float v, float blend)
     {
+        bool reserved = reserve();
         blend = clamp(blend, 0.0, 1.0);
-        float blended = v * blend + buffer[writeIndex] * (1.0 - blend);
+        float blended = v * blend + Storage::toFloat(buffer[writeIndex]) * (1.0 - blend);
 
-        buffer[writeIndex] = blended;
-        ++writeIndex %= size;
+        if (reserved)
+            buffer[writeIndex] = Storage::fromFloat(blended);
+        analysis.add(blended);
 
-        averageBuffer[averageIndex] = abs(blended);
-        ++averageIndex %= AVERAGE_SIZE;
+        if (++writeIndex >= size)
+        {
+            writeIndex = 0;
+            analysis.finish();
+        }
     }
 
     float getVoltage()
     {
-        float voltage = buffer[readIndex];
+        float voltage = Storage::toFloat(buffer[readIndex]);
         ++readIndex %= size;
         return voltage;
     }
 
-    float getAverageVoltage()
+    // count samples from writeIndex on, which must not run past size. Blends
+    // a block of floats at a time, converted on the way in and out.
+    void setVoltages(const float *v, int count, float blend)
     {
-        float average = 0;
-        for (int i = 0; i < AVERAGE_SIZE; i++)
+        bool reserved = reserve();
+        blend = clamp(blend, 0.0, 1.0);
+
+        float blended[HEX_BLOCK_SIZE];
+        Sample *w = buffer + writeIndex;
+        for (int start = 0; start < count; start += HEX_BLOCK_SIZE)
         {
-            average += averageBuffer[i];
+            int n = std::min(count - start, HEX_BLOCK_SIZE);
+
+            Storage::load(w + start, blended, n);
+            for (int i = 0; i < n; i++)
+            {
+                blended[i] = v[start + i] * blend + blended[i] * (1.0 - blend);
+                analysis.add(blended[i]);
+            }
+            if (reserved)
+                Storage::store(blended, w + start, n);
+        }
+
+        writeIndex += count;
+        if (writeIndex >= size)
+        {
+            writeIndex = 0;
+            analysis.finish();
         }
-        return average / AVERAGE_SIZE;
+    }
+
+    // count samples from readIndex on, which must not run past size
+    void getVoltages(float *v, int count)
+    {
+        Storage::load(buffer + readIndex, v, count);
+        readIndex = (readIndex + count) % size;
     }
 
     bool atWriteStart()
@@ -59,21 +281,331 @@ struct Grain
         size = clamp(intSize, MIN_GRAIN_SIZE, MAX_GRAIN_SIZE);
         writeIndex %= size;
         readIndex %= size;
+
+        // grow to fit, shrink once a much smaller block would do
+        if (sizeClass >= 0 && (size > capacity || size * 4 <= capacity))
+            resize();
     }
 };
 
+typedef StoredGrain<FloatSamples> Grain;
+
+// what HexaGrain sets and tools measure, whichever storage its grains use
 struct GrainHex : Hex
 {
-    std::vector<Grain> grains;
+    // the read cursor passes over grains whose last pass had a lower RMS, 0 for none
+    float skipBelow = 0;
+
+    // what voltages holds of each grain's last pass, see setDisplay
+    GrainDisplay display = GRAIN_LEVEL;
 
     GrainHex(int r) : Hex(r)
     {
+    }
+
+    virtual SampleFormat sampleFormat() const = 0;
+
+    // bytes of grain blocks held
+    virtual size_t grainBytes() const = 0;
+
+    // shows every grain's last pass as display
+    virtual void setDisplay(GrainDisplay d) = 0;
+};
+
+template <typename Storage>
+struct StoredGrainHex : GrainHex
+{
+    typedef StoredGrain<Storage> GrainType;
+
+    std::vector<GrainType> grains;
+
+    StoredGrainHex(int r) : GrainHex(r)
+    {
+        GrainPool::shared().refill();
         grains.resize(length);
+        dirtyChunks.assign(length, 0); // a chunk per grain
+    }
+
+    SampleFormat sampleFormat() const override
+    {
+        return Storage::format;
+    }
+
+    size_t grainBytes() const override
+    {
+        size_t bytes = 0;
+        for (const GrainType &grain : grains)
+            bytes += sizeof(GrainType) + grain.bytes();
+        return bytes;
+    }
+
+    // once per change, from the audio thread like skipBelow
+    void setDisplay(GrainDisplay d) override
+    {
+        if (d == display)
+            return;
+
+        display = d;
+        for (int c = 0; c < length; c++)
+            voltages[c] = grains[c].analysis.last.tileVoltage(display);
     }
 
     void setVoltage(float v, float blend) override
     {
         grains[writeCursor].setVoltage(v, blend);
+        dirtyChunks[writeCursor] = 1;
+    }
+
+    // a grain's size, then its samples unless it was never written
+    int chunkBytes() override
+    {
+        return sizeof(int32_t) + MAX_GRAIN_SIZE * sizeof(typename Storage::Sample);
+    }
+
+    int saveChunk(int c, char *data) override
+    {
+        GrainType &grain = grains[c];
+        int32_t size = grain.size;
+        int count = grain.sizeClass < 0 ? 0 : grain.size;
+
+        std::memcpy(data, &size, sizeof(size));
+        std::memcpy(data + sizeof(size), grain.buffer, count * sizeof(typename Storage::Sample));
+        dirtyChunks[c] = 0;
+        return sizeof(size) + count * sizeof(typename Storage::Sample);
+    }
+
+    void loadChunk(int c, const char *data, int bytes) override
+    {
+        int32_t size;
+        if (bytes < (int)sizeof(size))
+            return;
+        std::memcpy(&size, data, sizeof(size));
+
+        GrainType &grain = grains[c];
+        grain.size = clamp(size, MIN_GRAIN_SIZE, MAX_GRAIN_SIZE);
+        grain.writeIndex = grain.readIndex = 0;
+
+        int count = std::min<int>((bytes - sizeof(size)) / sizeof(typename Storage::Sample), grain.size);
+        if (count < 1)
+            return;
+
+        // out of blocks, the grain stays as it was, and the file keeps the chunk until it is written
+        if (grain.sizeClass < 0 || grain.size > grain.capacity || grain.size * 4 <= grain.capacity)
+            grain.resize();
+        if (!grain.reserve())
+            return;
+        count = std::min(count, grain.size);
+        std::memcpy(grain.buffer, data + sizeof(size), count * sizeof(typename Storage::Sample));
+        analyze(c, count);
+    }
+
+    // levels for skipping and the display, as if grain c's first count samples were just written
+    void analyze(int c, int count)
+    {
+        GrainType &grain = grains[c];
+        grain.analysis = GrainAnalysis();
+        for (int i = 0; i < count; i++)
+            grain.analysis.add(Storage::toFloat(grain.buffer[i]));
+        grain.analysis.finish();
+        voltages[c] = grain.analysis.last.tileVoltage(display);
+    }
+
+    // grain after grain, each to its size
+    int fillLength() override
+    {
+        int count = 0;
+        for (const GrainType &grain : grains)
+            count += grain.size;
+        return count;
+    }
+
+    // on a worker, which tops up the pool as it goes
+    void fill(const float *v, int count) override
+    {
+        for (int c = 0; c < length; c++)
+        {
+            GrainType &grain = grains[c];
+            int n = clamp(count, 0, grain.size);
+            grain.writeIndex = grain.readIndex = 0;
+            GrainPool::shared().refill();
+            if ((n > 0 || grain.sizeClass >= 0) && grain.reserve())
+            {
+                Storage::store(v, grain.buffer, n);
+                std::fill(grain.buffer + n, grain.buffer + grain.capacity, typename Storage::Sample(0));
+            }
+            analyze(c, n);
+            dirtyChunks[c] = 1;
+            v += n;
+            count -= n;
+        }
+    }
+
+    int copyChunk(int c, float *v) override
+    {
+        Storage::load(grains[c].buffer, v, grains[c].size);
+        return grains[c].size;
+    }
+
+    int chunkTiles() override
+    {
+        return 1;
+    }
+
+    // sizes grain c to count, leaving a silent one on the zeros. On a worker, as fill.
+    void fillChunk(int c, const float *v, int count) override
+    {
+        GrainPool::shared().refill();
+
+        GrainType &grain = grains[c];
+        grain.size = clamp(count, MIN_GRAIN_SIZE, MAX_GRAIN_SIZE);
+        grain.writeIndex = grain.readIndex = 0;
+        count = std::min(count, grain.size);
+        dirtyChunks[c] = 1;
+
+        if (grain.sizeClass < 0 && std::all_of(v, v + count, [](float x)
+                                               { return x == 0.f; }))
+        {
+            analyze(c, 0);
+            return;
+        }
+
+        if (grain.sizeClass < 0 || grain.size > grain.capacity || grain.size * 4 <= grain.capacity)
+            grain.resize();
+        if (!grain.reserve())
+        {
+            analyze(c, 0);
+            return;
+        }
+        count = std::min(count, grain.size);
+        Storage::store(v, grain.buffer, count);
+        std::fill(grain.buffer + count, grain.buffer + grain.capacity, typename Storage::Sample(0));
+        analyze(c, count);
+    }
+
+    /*
+        Snapshots of the grains, each holding the blocks the grains held when
+        it was captured. A grain writes to a copy of a block a snapshot keeps,
+        so only grains written after a capture take more memory, and recall
+        hands the blocks back. A slot's table is made by its first capture.
+    */
+    struct GrainSnapshot
+    {
+        typename Storage::Sample *buffer = nullptr; // nullptr for a grain on the zeros
+        int sizeClass = -1;
+        int capacity = 0;
+        int size = MAX_GRAIN_SIZE;
+        GrainStats last;
+    };
+
+    std::vector<GrainSnapshot> grainSnapshots[SNAPSHOT_SLOTS];
+
+    ~StoredGrainHex()
+    {
+        for (int s = 0; s < SNAPSHOT_SLOTS; s++)
+            clearSnapshot(s);
+    }
+
+    void captureSnapshot(int s) override
+    {
+        clearSnapshot(s);
+        grainSnapshots[s].resize(length);
+        for (int c = 0; c < length; c++)
+        {
+            GrainType &grain = grains[c];
+            GrainSnapshot &kept = grainSnapshots[s][c];
+            kept.size = grain.size;
+            kept.last = grain.analysis.last;
+            if (grain.sizeClass >= 0)
+            {
+                kept.buffer = grain.buffer;
+                kept.sizeClass = grain.sizeClass;
+                kept.capacity = grain.capacity;
+                grain.kept = true;
+            }
+        }
+        snapshotCaptured[s] = true;
+    }
+
+    // recall hands blocks back rather than copying them
+    bool recallCopies() override
+    {
+        return false;
+    }
+
+    bool recallSnapshot(int s) override
+    {
+        if (!snapshotCaptured[s])
+            return false;
+
+        for (int c = 0; c < length; c++)
+        {
+            GrainType &grain = grains[c];
+            const GrainSnapshot &kept = grainSnapshots[s][c];
+
+            bool same = kept.buffer ? grain.buffer == kept.buffer : grain.sizeClass < 0;
+            if (!same)
+            {
+                if (grain.sizeClass >= 0 && !grain.kept)
+                    GrainPool::shared().release(grain.buffer, grain.sizeClass);
+
+                grain.buffer = kept.buffer ? kept.buffer : static_cast<typename Storage::Sample *>(GrainPool::zeros());
+                grain.sizeClass = kept.sizeClass;
+                grain.capacity = kept.capacity;
+                grain.kept = kept.buffer != nullptr;
+            }
+
+            grain.size = kept.size;
+            grain.writeIndex %= grain.size;
+            grain.readIndex %= grain.size;
+            grain.analysis = GrainAnalysis();
+            grain.analysis.last = kept.last;
+            voltages[c] = kept.last.tileVoltage(display);
+            dirtyChunks[c] = 1;
+        }
+        ringSumCursor = -1;
+        return true;
+    }
+
+    // blocks no other slot or grain holds go back to the pool
+    void clearSnapshot(int s) override
+    {
+        for (int c = 0; c < (int)grainSnapshots[s].size(); c++)
+        {
+            GrainSnapshot kept = grainSnapshots[s][c];
+            grainSnapshots[s][c] = GrainSnapshot();
+            if (!kept.buffer || grainKept(c, kept.buffer))
+                continue;
+
+            if (grains[c].buffer == kept.buffer)
+                grains[c].kept = false;
+            else
+                GrainPool::shared().release(kept.buffer, kept.sizeClass);
+        }
+        snapshotCaptured[s] = false;
+    }
+
+    // whether any slot holds buffer as grain c
+    bool grainKept(int c, const typename Storage::Sample *buffer)
+    {
+        for (int s = 0; s < SNAPSHOT_SLOTS; s++)
+        {
+            if (c < (int)grainSnapshots[s].size() && grainSnapshots[s][c].buffer == buffer)
+                return true;
+        }
+        return false;
+    }
+
+    // grains keep their place in the new ones, where it still fits
+    void swapBuffer(Hex &other) override
+    {
+        StoredGrainHex &shadow = static_cast<StoredGrainHex &>(other);
+        for (int c = 0; c < length; c++)
+        {
+            shadow.grains[c].writeIndex = grains[c].writeIndex % shadow.grains[c].size;
+            shadow.grains[c].readIndex = grains[c].readIndex % shadow.grains[c].size;
+        }
+        grains.swap(shadow.grains);
+        Hex::swapBuffer(other);
     }
 
     // float getVoltage() override
@@ -84,17 +616,54 @@ struct GrainHex : Hex
 
     float getTileVoltage(int i) override
     {
-        tiles[i].read = 1;
+        markRead(i);
         return grains[i].getVoltage();
     }
 
+    float getRingVoltage() override
+    {
+        return readSpread();
+    }
+
+    /*
+        The read ring, with every grain on it read at the read grain's phase,
+        scaled to its own size, and left where it was. Only the read grain moves
+        on. Each grain is read a sample further along than last time, so the
+        line after it is fetched ahead, as a wide ring has more grains than the
+        hardware prefetcher follows.
+    */
+    float readSpread()
+    {
+        markRingRead(readCursor);
+
+        GrainType &center = grains[readCursor];
+        int64_t phase = center.readIndex;
+        int centerSize = center.size;
+        float voltage = center.getVoltage();
+
+        int base = readCursor % readLength;
+        for (int tap : ringTaps)
+        {
+            int i = base + tap;
+            if (i >= readLength)
+                i -= readLength;
+
+            const GrainType &grain = grains[i];
+            int index = grain.size == centerSize ? phase : phase * grain.size / centerSize;
+            __builtin_prefetch(grain.buffer + index + 64 / sizeof(typename Storage::Sample));
+            voltage += Storage::toFloat(grain.buffer[index]);
+        }
+
+        return voltage * ringScale;
+    }
+
     void advanceWriteCursor(float x, float y, float z) override
     {
         // do nothing unless at start of a grain
         if (grains[writeCursor].atWriteStart())
         {
-            tiles[writeCursor].writ = 1;
-            tiles[writeCursor].v = grains[writeCursor].getAverageVoltage();
+            voltages[writeCursor] = grains[writeCursor].analysis.last.tileVoltage(display);
+            markWrite(writeCursor);
 
             Hex::advanceWriteCursor(x, y, z);
         }
@@ -106,6 +675,9 @@ struct GrainHex : Hex
         if (grains[readCursor].atReadStart())
         {
             Hex::advanceReadCursor(x, y, z);
+
+            for (int i = 0; i < GRAIN_SKIP_LIMIT && grains[readCursor].analysis.last.rms < skipBelow; i++)
+                Hex::advanceReadCursor(x, y, z);
         }
     }
 
@@ -113,4 +685,108 @@ struct GrainHex : Hex
     {
         grains[writeCursor].setSize(size);
     }
-};
\ No newline at end of file
+
+    // one sample of the per-sample path, including the grain size update
+    template <bool Spread>
+    float processSample(float in, const CursorParams &p)
+    {
+        StoredGrainHex::setVoltage(in, p.blend);
+
+        float out;
+        if (!Spread)
+            out = StoredGrainHex::getTileVoltage(readCursor);
+        else
+            out = readSpread();
+
+        StoredGrainHex::advanceWriteCursor(p.writeX, p.writeY, p.writeZ);
+        StoredGrainHex::advanceReadCursor(p.readX, p.readY, p.readZ);
+        StoredGrainHex::setSize(p.grainSize);
+        return out;
+    }
+
+    // cursors and sizes move at grain boundaries, so only the spread is worth a kernel
+    SampleKernel sampleKernel() override
+    {
+        if (ringRadius >= 1)
+            return static_cast<SampleKernel>(&StoredGrainHex::processSample<true>);
+        return static_cast<SampleKernel>(&StoredGrainHex::processSample<false>);
+    }
+
+    void processBlock(const float *in, float *out, int n, const CursorParams &p) override
+    {
+        if (ringRadius >= 1)
+            processRuns<true>(in, out, n, p);
+        else
+            processRuns<false>(in, out, n, p);
+    }
+
+    /*
+        Cursors only move at grain boundaries, so the block is split into runs
+        that stay within one write grain and one read grain, and each run is
+        copied in a tight loop. Spread reads leave the ring's grains alone, so
+        they run a sample at a time within the same runs.
+    */
+    template <bool Spread>
+    void processRuns(const float *in, float *out, int n, const CursorParams &p)
+    {
+        if (n < 1)
+            return;
+
+        // the first sample may still see the previous grain size
+        out[0] = processSample<Spread>(in[0], p);
+
+        for (int i = 1; i < n;)
+        {
+            GrainType &w = grains[writeCursor];
+            GrainType &r = grains[readCursor];
+
+            int count = std::min(n - i, std::min(w.size - w.writeIndex, r.size - r.readIndex));
+
+            if (Spread)
+            {
+                for (int j = i; j < i + count; j++)
+                {
+                    w.setVoltage(in[j], p.blend);
+                    out[j] = readSpread();
+                }
+            }
+            else if (&w == &r)
+            {
+                for (int j = i; j < i + count; j++)
+                {
+                    w.setVoltage(in[j], p.blend);
+                    out[j] = r.getVoltage();
+                }
+            }
+            else
+            {
+                w.setVoltages(in + i, count, p.blend);
+                r.getVoltages(out + i, count);
+            }
+            dirtyChunks[writeCursor] = 1;
+
+            if (!Spread)
+                markRead(readCursor);
+            i += count;
+
+            // as in the per-sample path, these only move at a grain boundary
+            StoredGrainHex::advanceWriteCursor(p.writeX, p.writeY, p.writeZ);
+            StoredGrainHex::advanceReadCursor(p.readX, p.readY, p.readZ);
+            StoredGrainHex::setSize(p.grainSize);
+        }
+    }
+};
+
+// a HexaGrain's hex of radius r, storing samples as format
+inline GrainHex *createStoredGrainHex(int r, SampleFormat format)
+{
+    switch (format)
+    {
+    case FIXED16_SAMPLES:
+        return new StoredGrainHex<Fixed16Samples>(r);
+    case HALF_SAMPLES:
+        return new StoredGrainHex<HalfSamples>(r);
+    default:
+        return new StoredGrainHex<FloatSamples>(r);
+    }
+}
@@ -0,0 +1,194 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+// samples in the largest grain
+#define MAX_GRAIN_SIZE 4410
+
+// bytes the pool takes from the system at a time, one huge page where there are any
+#define GRAIN_POOL_CHUNK (2 << 20)
+
+// chunks taken ahead of need, enough for a size sweep across a whole hex
+// between two refills. Untouched, they cost address space only.
+#define GRAIN_POOL_SPARES 4
+
+// spares left below which upkeep tops them up, see topUp
+#define GRAIN_POOL_LOW_SPARES 2
+
+// block sizes in bytes, in half steps so a grain sized to fit wastes at most a
+// third, plus one that fits the largest 16-bit grain
+static const int GRAIN_POOL_CLASSES[] = {128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096, 6144, 8192, 8832, 12288, 16384, 17664};
+static const int GRAIN_POOL_CLASS_COUNT = sizeof(GRAIN_POOL_CLASSES) / sizeof(int);
+
+static_assert(MAX_GRAIN_SIZE * sizeof(float) <= 17664, "the largest float grain must fit the largest block");
+static_assert(MAX_GRAIN_SIZE * sizeof(int16_t) <= 8832, "the largest 16-bit grain must fit its block");
+
+/*
+    Grain buffers for every GrainHex in the process, so memory follows the
+    grain sizes in use rather than the largest a grain could be. Blocks are
+    cut from chunks that are never given back, and freed blocks wait on a list
+    per size for the next grain of that size, whichever hex it belongs to.
+
+    Grains resize from the audio thread when the size knob moves, so the lock
+    is a spinlock held for a few pointer moves, and a chunk that runs out is
+    followed by a spare taken from the system ahead of time. In Rack the
+    upkeep thread tops the spares up once they run low, see topUp, and
+    allocate gives nullptr rather than wait on the system once they are gone.
+    Elsewhere allocate tops them up itself, outside the lock.
+*/
+
+struct GrainPool
+{
+    // a free block, linked through its own first bytes
+    struct FreeBlock
+    {
+        FreeBlock *next;
+    };
+
+    FreeBlock *freeBlocks[GRAIN_POOL_CLASS_COUNT] = {};
+    char *chunk = nullptr;
+    size_t chunkUsed = GRAIN_POOL_CHUNK;
+    std::atomic_flag lock = ATOMIC_FLAG_INIT;
+
+    std::atomic<char *> spares[GRAIN_POOL_SPARES] = {};
+
+    // false in Rack, where allocate runs on the audio thread, see refill
+    bool refillOnAllocate = true;
+
+    static GrainPool &shared()
+    {
+        static GrainPool pool;
+        return pool;
+    }
+
+    // what grains read before they are first written, never written itself.
+    // All zero bits are a zero sample in every SampleFormat.
+    static void *zeros()
+    {
+        static float zeros[MAX_GRAIN_SIZE] = {};
+        return zeros;
+    }
+
+    // the smallest class that holds bytes
+    static int classFor(size_t bytes)
+    {
+        int c = 0;
+        while (c < GRAIN_POOL_CLASS_COUNT - 1 && size_t(GRAIN_POOL_CLASSES[c]) < bytes)
+            c++;
+        return c;
+    }
+
+    // a block of the class, or nullptr when the free list and spares are empty
+    void *allocate(int sizeClass)
+    {
+        size_t bytes = GRAIN_POOL_CLASSES[sizeClass];
+
+        while (lock.test_and_set(std::memory_order_acquire))
+            ;
+
+        void *block = freeBlocks[sizeClass];
+        if (block)
+            freeBlocks[sizeClass] = freeBlocks[sizeClass]->next;
+        else
+        {
+            if (chunkUsed + bytes > GRAIN_POOL_CHUNK)
+            {
+                char *spare = takeSpare();
+                if (spare)
+                {
+                    chunk = spare;
+                    chunkUsed = 0;
+                }
+            }
+            if (chunkUsed + bytes <= GRAIN_POOL_CHUNK)
+            {
+                block = chunk + chunkUsed;
+                chunkUsed += bytes;
+            }
+        }
+
+        lock.clear(std::memory_order_release);
+
+        if (refillOnAllocate)
+        {
+            bool refilled = refill();
+            if (!block && refilled)
+                return allocate(sizeClass);
+        }
+        return block;
+    }
+
+    void release(void *block, int sizeClass)
+    {
+        FreeBlock *freeBlock = reinterpret_cast<FreeBlock *>(block);
+
+        while (lock.test_and_set(std::memory_order_acquire))
+            ;
+
+        freeBlock->next = freeBlocks[sizeClass];
+        freeBlocks[sizeClass] = freeBlock;
+
+        lock.clear(std::memory_order_release);
+    }
+
+    char *takeSpare()
+    {
+        for (std::atomic<char *> &spare : spares)
+        {
+            char *taken = spare.exchange(nullptr, std::memory_order_acquire);
+            if (taken)
+                return taken;
+        }
+        return nullptr;
+    }
+
+    // upkeep thread, refills once fewer than GRAIN_POOL_LOW_SPARES are left,
+    // so a resize sweep takes chunks a few at a time
+    void topUp()
+    {
+        int left = 0;
+        for (std::atomic<char *> &spare : spares)
+            left += spare.load(std::memory_order_relaxed) != nullptr;
+        if (left < GRAIN_POOL_LOW_SPARES)
+            refill();
+    }
+
+    // anywhere but the audio thread, false if the system is out of memory
+    bool refill()
+    {
+        for (std::atomic<char *> &spare : spares)
+        {
+            if (spare.load(std::memory_order_relaxed))
+                continue;
+
+            char *fresh = newChunk();
+            if (!fresh)
+                return false;
+
+            char *none = nullptr;
+            if (!spare.compare_exchange_strong(none, fresh, std::memory_order_release))
+                std::free(fresh);
+        }
+        return true;
+    }
+
+    static char *newChunk()
+    {
+#ifdef _WIN32
+        return static_cast<char *>(std::malloc(GRAIN_POOL_CHUNK));
+#else
+        void *memory = nullptr;
+        if (posix_memalign(&memory, GRAIN_POOL_CHUNK, GRAIN_POOL_CHUNK))
+            return nullptr;
+#ifdef MADV_HUGEPAGE
+        madvise(memory, GRAIN_POOL_CHUNK, MADV_HUGEPAGE);
+#endif
+        return static_cast<char *>(memory);
+#endif
+    }
+};
@@ -2,14 +2,90 @@
 #include <cmath>
 #include <algorithm>
 #include <array>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <vector>
 
-struct Tile
+#include "Activity.hpp"
+#include "GrainPool.hpp"
+#include "SampleStorage.hpp"
+#include "TilePyramid.hpp"
+
+#define HEX_BLOCK_SIZE 64
+#define RING_SUM_REFRESH 1024
+
+// tiles in each chunk of a saved buffer, see Hex::saveChunk
+#define HEX_CHUNK_BITS 10
+#define HEX_CHUNK_TILES (1 << HEX_CHUNK_BITS)
+
+// buffers each hex can keep a snapshot of, a bit each in Hex::snapshotPending
+#define SNAPSHOT_SLOTS 8
+
+static_assert(SNAPSHOT_SLOTS <= 8, "a snapshot bit per slot in a byte");
+static_assert(HEX_CHUNK_TILES * sizeof(float) <= 17664, "snapshot chunks come from the grain pool");
+
+// vector positions are fixed point with this many bits below a tile
+#define CURSOR_FRACTION_BITS 32
+#define CURSOR_ONE (int64_t(1) << CURSOR_FRACTION_BITS)
+
+// tiles in a hex of radius r, centred hexagonal numbers
+constexpr int hexLength(int r)
+{
+    return 3 * r * (r - 1) + 1;
+}
+
+// tiles along the y axis, the index step from one row to the next
+constexpr int hexYAxis(int r)
 {
-    float x;
-    float y;
-    float v;
-    float writ;
-    float read;
+    return 3 * r - 2;
+}
+
+// radius of each module's hex
+#define HEXNUT_RADIUS 86
+#define HEXAGRAIN_RADIUS 16
+
+static_assert(hexLength(HEXAGRAIN_RADIUS) == 721, "HexaGrain geometry");
+static_assert(hexLength(HEXNUT_RADIUS) == 21931, "HexNut geometry");
+
+/*
+    A vector position on each hex axis, in tiles, as fixed point kept within
+    [0, length). Adding the same steps always lands on the same tiles, however
+    long a loop runs.
+*/
+struct VectorPhase
+{
+    int64_t x = 0;
+    int64_t y = 0;
+    int64_t z = 0;
+};
+
+// where a cursor is on its ring or vortex, see Hex::stepRing
+struct RingWalk
+{
+    int cursor = 0; // offset from the vector position
+    int lapStart = 0;
+    int lapRadius = 1;
+    int lapStep = 0;
+    int vortexRadius = 0; // grows by one every lap in VORTEX mode
+};
+
+/*
+    Everything a sample or a block of samples needs besides the audio itself.
+    Held fixed for the length of a block.
+*/
+
+struct CursorParams
+{
+    float writeX = 0;
+    float writeY = 0;
+    float writeZ = 0;
+    float readX = 0;
+    float readY = 0;
+    float readZ = 0;
+    float blend = 1;
+    float grainSize = 1;
 };
 
 struct Hex
@@ -33,27 +109,54 @@ struct Hex
     int y_step;
     int z_step;
 
-    std::vector<Tile> tiles;
+    // one entry per tile in each, so the audio path only pulls voltages into cache
+    std::vector<float> voltages;
+    const TilePosition *positions; // shared by every hex of this radius, see initTiles
+    const PyramidLayout *pyramidLayout; // groups of tiles for the display, also shared
 
-    int writeCursor = 0;
-    int writeRingCursor = 0;
+    ActivityChannel activityOut; // tiles read and written, for the display
+
+    std::vector<uint8_t> dirtyChunks; // chunks written since they were last saved
 
+    // snapshots, see captureSnapshot
+    bool snapshotCaptured[SNAPSHOT_SLOTS] = {};
+    std::vector<float *> snapshotChunks[SNAPSHOT_SLOTS]; // copies kept of chunks since written
+    std::vector<uint8_t> snapshotPending;                // slots still sharing each chunk with the buffer
+    int pendingChunks = 0;                               // chunks with any slot pending
+    uint8_t snapshotsDropped = 0;                        // slots keepChunk gave up on, for the module
+
+    // a recall built off the audio thread, see prepareRecall
+    int recallSlot = 0;
+    std::vector<float *> recallChunks; // the slot's copies when the recall was asked for
+    std::vector<float> recallBuffer;
+
+    // offsets around a ring of each radius, lap by lap, also shared
+    const std::vector<std::vector<int>> *laps;
+
+    int writeCursor = 0;
     int readCursor = 0;
-    int readRingCursor = 0;
 
-    float writeX = 0;
-    float writeY = 0;
-    float writeZ = 0;
+    VectorPhase writePhase;
+    VectorPhase readPhase;
+    int64_t phaseLength;
 
-    float readX = 0;
-    float readY = 0;
-    float readZ = 0;
+    RingWalk writeWalk;
+    RingWalk readWalk;
 
     int ringRadius = 0; // radius of ring around cursor
     int maxRingRadius = 64;
     std::vector<int> ringDirs;    // directions around a ring
     std::vector<int> ringOffsets; // given a radius, offsets from cursor to ring around cursor
 
+    // incremental spread, see readRing
+    std::vector<int> ringTaps;               // ringOffsets wrapped into [0, readLength)
+    std::vector<uint16_t> ringTapCounts;     // number of taps at each distance from the cursor
+    float ringScale = 1;
+    float ringSum = 0;
+    int ringSumCursor = -1; // cursor ringSum is around, -1 when it must be summed again
+    int ringSumBase = 0;
+    int ringSumAge = 0;
+
     enum Mode
     {
         VECTOR,
@@ -70,14 +173,7 @@ struct Hex
     Mode writeMode = Mode::VECTOR;
     Mode readMode = Mode::VECTOR;
 
-    int writePosRingRadius;
-    int writePosRingDir = 0;
-    int writePosRingStep = 0;
     int writeMaxRadius;
-
-    int readPosRingRadius;
-    int readPosRingDir = 0;
-    int readPosRingStep = 0;
     int readMaxRadius;
 
     Hex(int r) : radius(r)
@@ -86,6 +182,12 @@ struct Hex
         initTiles();
     }
 
+    virtual ~Hex()
+    {
+        for (int s = 0; s < SNAPSHOT_SLOTS; s++)
+            clearTileSnapshot(s);
+    }
+
     void initGeometry()
     {
         size = .5 * 86 / radius;
@@ -97,25 +199,24 @@ struct Hex
         width = diameter * dx;
         height = diameter * dy;
 
-        yAxis = 3 * radius - 2;
-
-        // 721 if radius = 16
-        // 21931 if radius = 86
-        length = pow(radius, 3) - pow(radius - 1, 3);
+        yAxis = hexYAxis(radius);
+        length = hexLength(radius);
 
         readLength = length;
         writeLength = length;
+        phaseLength = length * CURSOR_ONE;
 
         y_step = yAxis;
         z_step = y_step + 1;
 
         ringDirs = {-1, -z_step, -y_step, 1, z_step, y_step};
         ringOffsets.resize(maxRingRadius * 6);
+        ringTapCounts.assign(length, 0);
 
-        writePosRingRadius = radius / 2;
+        writeWalk.vortexRadius = radius / 2;
         writeMaxRadius = radius;
 
-        readPosRingRadius = radius / 2;
+        readWalk.vortexRadius = radius / 2;
         readMaxRadius = radius;
     }
 
@@ -141,7 +242,12 @@ struct Hex
     void setCrop(float v)
     {
         int r = voltageToRadius(v);
-        readLength = writeLength = pow(r, 3) - pow(r - 1, 3);
+        int newLength = hexLength(r);
+        if (newLength != readLength)
+        {
+            readLength = writeLength = newLength;
+            updateRingTaps();
+        }
     }
 
     virtual void setSize(float newSize)
@@ -152,8 +258,30 @@ struct Hex
     virtual void setVoltage(float v, float blend)
     {
         blend = clamp(blend, 0.0, 1.0);
-        tiles[writeCursor].v = v * blend + tiles[writeCursor].v * (1.0 - blend);
-        tiles[writeCursor].writ = 1;
+        writeTile(writeCursor, v * blend + voltages[writeCursor] * (1.0 - blend));
+    }
+
+    // sets tile i, and the ring sum if i is one of its taps
+    void writeTile(int i, float v)
+    {
+        if (snapshotPending[i >> HEX_CHUNK_BITS])
+            keepChunk(i >> HEX_CHUNK_BITS);
+
+        float delta = v - voltages[i];
+        voltages[i] = v;
+        dirtyChunks[i >> HEX_CHUNK_BITS] = 1;
+        markWrite(i);
+
+        if (ringSumCursor >= 0)
+        {
+            int taps = i == ringSumCursor;
+            if (i < readLength)
+            {
+                int d = i - ringSumBase;
+                taps += ringTapCounts[d < 0 ? d + readLength : d];
+            }
+            ringSum += delta * taps;
+        }
     }
 
     float getVoltage()
@@ -161,44 +289,497 @@ struct Hex
         return ringRadius < 1 ? getTileVoltage(readCursor) : getRingVoltage();
     }
 
+    // marks for the display, offered to it every so many reads
+    void markWrite(int i)
+    {
+        activityOut.frame().writes.add(i);
+    }
+
+    void markRead(int i)
+    {
+        activityOut.frame().reads.add(i);
+        if (activityOut.offerDue())
+            offerActivity();
+    }
+
+    void markRingRead(int cursor)
+    {
+        activityOut.frame().ringReads.add(cursor);
+        if (activityOut.offerDue())
+            offerActivity();
+    }
+
+    void offerActivity()
+    {
+        ActivityFrame &frame = activityOut.frame();
+        frame.ringRadius = ringRadius;
+        frame.readLength = readLength;
+        activityOut.offer();
+    }
+
     virtual float getTileVoltage(int i)
     {
-        tiles[i].read = 1;
-        return tiles[i].v;
+        markRead(i);
+        return voltages[i];
+    }
+
+    virtual float getRingVoltage()
+    {
+        return readRing(readCursor);
+    }
+
+    /*
+        The read ring kept as a running sum. Writes that land on the ring adjust
+        it as they go, so while the cursor stays on a tile a read costs nothing.
+        A hollow ring of 6r taps that moves by one tile keeps only the 2r on
+        the two sides along the move, so updating it would touch 8r taps
+        where summing it again touches 6r. A move sums it again, as does every
+        RING_SUM_REFRESH samples to shed rounding error. The display lights
+        up the whole ring from its cursor.
+    */
+    float readRing(int cursor)
+    {
+        markRingRead(cursor);
+
+        if (cursor != ringSumCursor || ++ringSumAge >= RING_SUM_REFRESH)
+        {
+            int base = cursor % readLength;
+            float voltage = voltages[cursor];
+
+            for (int tap : ringTaps)
+            {
+                int i = base + tap;
+                if (i >= readLength)
+                    i -= readLength;
+                voltage += voltages[i];
+            }
+
+            ringSum = voltage;
+            ringSumCursor = cursor;
+            ringSumBase = base;
+            ringSumAge = 0;
+        }
+
+        return ringSum * ringScale;
+    }
+
+    /*
+        Same result as calling setVoltage, getVoltage, advanceWriteCursor and
+        advanceReadCursor once per sample, but through a kernel built for the
+        current modes and spread, picked again only when one of them changes.
+    */
+    virtual void processBlock(const float *in, float *out, int n, const CursorParams &p)
+    {
+        processBlockAs<FloatSamples>(in, out, n, p);
+    }
+
+    // writes land on values Storage can hold, see StoredHex
+    template <typename Storage>
+    void processBlockAs(const float *in, float *out, int n, const CursorParams &p)
+    {
+        bool spread = ringRadius >= 1;
+        if (!blockKernel || writeMode != kernelWriteMode || readMode != kernelReadMode || spread != kernelSpread)
+        {
+            blockKernel = blockKernelFor<Storage>(writeMode, readMode, spread);
+            kernelWriteMode = writeMode;
+            kernelReadMode = readMode;
+            kernelSpread = spread;
+        }
+
+        (this->*blockKernel)(in, out, n, p);
+    }
+
+    typedef void (Hex::*BlockKernel)(const float *in, float *out, int n, const CursorParams &p);
+
+    BlockKernel blockKernel = nullptr;
+    Mode kernelWriteMode = VECTOR;
+    Mode kernelReadMode = VECTOR;
+    bool kernelSpread = false;
+
+    template <typename S>
+    static BlockKernel blockKernelFor(Mode writeMode, Mode readMode, bool spread)
+    {
+        static const BlockKernel kernels[3][3][2] = {
+            {{&Hex::processBlockKernel<VECTOR, VECTOR, false, S>, &Hex::processBlockKernel<VECTOR, VECTOR, true, S>},
+             {&Hex::processBlockKernel<VECTOR, RING, false, S>, &Hex::processBlockKernel<VECTOR, RING, true, S>},
+             {&Hex::processBlockKernel<VECTOR, VORTEX, false, S>, &Hex::processBlockKernel<VECTOR, VORTEX, true, S>}},
+            {{&Hex::processBlockKernel<RING, VECTOR, false, S>, &Hex::processBlockKernel<RING, VECTOR, true, S>},
+             {&Hex::processBlockKernel<RING, RING, false, S>, &Hex::processBlockKernel<RING, RING, true, S>},
+             {&Hex::processBlockKernel<RING, VORTEX, false, S>, &Hex::processBlockKernel<RING, VORTEX, true, S>}},
+            {{&Hex::processBlockKernel<VORTEX, VECTOR, false, S>, &Hex::processBlockKernel<VORTEX, VECTOR, true, S>},
+             {&Hex::processBlockKernel<VORTEX, RING, false, S>, &Hex::processBlockKernel<VORTEX, RING, true, S>},
+             {&Hex::processBlockKernel<VORTEX, VORTEX, false, S>, &Hex::processBlockKernel<VORTEX, VORTEX, true, S>}}};
+
+        return kernels[clamp((int)writeMode, 0, 2)][clamp((int)readMode, 0, 2)][spread];
+    }
+
+    // cursors are worked out for the whole block first, leaving the buffer access as a tight loop
+    template <Mode W, Mode R, bool Spread, typename Storage>
+    void processBlockKernel(const float *in, float *out, int n, const CursorParams &p)
+    {
+        int writeIndices[HEX_BLOCK_SIZE];
+        int readIndices[HEX_BLOCK_SIZE];
+
+        float blend = clamp(p.blend, 0.0, 1.0);
+
+        for (int start = 0; start < n; start += HEX_BLOCK_SIZE)
+        {
+            int count = std::min(n - start, HEX_BLOCK_SIZE);
+
+            // cursors only depend on their own state, not on the buffer
+            for (int i = 0; i < count; i++)
+            {
+                writeIndices[i] = writeCursor;
+                readIndices[i] = readCursor;
+                placeWriteCursor<W>(moveWriteVector(p.writeX, p.writeY, p.writeZ));
+                placeReadCursor<R>(moveReadVector(p.readX, p.readY, p.readZ));
+            }
+
+            // snapshots keep the chunks this block is about to change
+            if (pendingChunks > 0)
+            {
+                for (int i = 0; i < count; i++)
+                    keepChunk(writeIndices[i] >> HEX_CHUNK_BITS);
+            }
+
+            // reads can land on tiles written earlier in the block, so keep sample order
+            const float *blockIn = in + start;
+            float *blockOut = out + start;
+
+            if (!Spread)
+            {
+                for (int i = 0; i < count; i++)
+                {
+                    float &w = voltages[writeIndices[i]];
+                    w = Storage::toFloat(Storage::fromFloat(blockIn[i] * blend + w * (1.0 - blend)));
+                    dirtyChunks[writeIndices[i] >> HEX_CHUNK_BITS] = 1;
+                    markWrite(writeIndices[i]);
+
+                    markRead(readIndices[i]);
+                    blockOut[i] = voltages[readIndices[i]];
+                }
+            }
+            else
+            {
+                for (int i = 0; i < count; i++)
+                {
+                    float w = voltages[writeIndices[i]];
+                    writeTile(writeIndices[i], Storage::toFloat(Storage::fromFloat(blockIn[i] * blend + w * (1.0 - blend))));
+
+                    blockOut[i] = readRing(readIndices[i]);
+                }
+            }
+        }
+    }
+
+    /*
+        One sample through a kernel for the current modes and spread, for
+        HexEngine::step when params change on every sample, as they do while
+        a ramp runs. HexEngine picks one whenever the controls change. Blocks
+        with fixed params go through processBlock instead.
+    */
+    typedef float (Hex::*SampleKernel)(float in, const CursorParams &p);
+
+    // writes land on values the storage can hold, see StoredHex
+    virtual SampleKernel sampleKernel()
+    {
+        return sampleKernelFor<FloatSamples>(writeMode, readMode, ringRadius >= 1);
+    }
+
+    template <typename S>
+    static SampleKernel sampleKernelFor(Mode writeMode, Mode readMode, bool spread)
+    {
+        static const SampleKernel kernels[3][3][2] = {
+            {{&Hex::sampleKernel<VECTOR, VECTOR, false, S>, &Hex::sampleKernel<VECTOR, VECTOR, true, S>},
+             {&Hex::sampleKernel<VECTOR, RING, false, S>, &Hex::sampleKernel<VECTOR, RING, true, S>},
+             {&Hex::sampleKernel<VECTOR, VORTEX, false, S>, &Hex::sampleKernel<VECTOR, VORTEX, true, S>}},
+            {{&Hex::sampleKernel<RING, VECTOR, false, S>, &Hex::sampleKernel<RING, VECTOR, true, S>},
+             {&Hex::sampleKernel<RING, RING, false, S>, &Hex::sampleKernel<RING, RING, true, S>},
+             {&Hex::sampleKernel<RING, VORTEX, false, S>, &Hex::sampleKernel<RING, VORTEX, true, S>}},
+            {{&Hex::sampleKernel<VORTEX, VECTOR, false, S>, &Hex::sampleKernel<VORTEX, VECTOR, true, S>},
+             {&Hex::sampleKernel<VORTEX, RING, false, S>, &Hex::sampleKernel<VORTEX, RING, true, S>},
+             {&Hex::sampleKernel<VORTEX, VORTEX, false, S>, &Hex::sampleKernel<VORTEX, VORTEX, true, S>}}};
+
+        return kernels[clamp((int)writeMode, 0, 2)][clamp((int)readMode, 0, 2)][spread];
+    }
+
+    // without a spread, the write skips the ring sum and the read is a tile
+    template <Mode W, Mode R, bool Spread, typename Storage>
+    float sampleKernel(float in, const CursorParams &p)
+    {
+        float blend = clamp(p.blend, 0.0, 1.0);
+        float out;
+
+        if (!Spread)
+        {
+            int chunk = writeCursor >> HEX_CHUNK_BITS;
+            if (snapshotPending[chunk])
+                keepChunk(chunk);
+
+            float &w = voltages[writeCursor];
+            w = Storage::toFloat(Storage::fromFloat(in * blend + w * (1.0 - blend)));
+            dirtyChunks[chunk] = 1;
+            markWrite(writeCursor);
+
+            markRead(readCursor);
+            out = voltages[readCursor];
+        }
+        else
+        {
+            float w = voltages[writeCursor];
+            writeTile(writeCursor, Storage::toFloat(Storage::fromFloat(in * blend + w * (1.0 - blend))));
+            out = readRing(readCursor);
+        }
+
+        placeWriteCursor<W>(moveWriteVector(p.writeX, p.writeY, p.writeZ));
+        placeReadCursor<R>(moveReadVector(p.readX, p.readY, p.readZ));
+        return out;
+    }
+
+    /*
+        The buffer in chunks, for BufferStore to save and load from the audio
+        thread. A chunk saves to at most chunkBytes, and only those marked in
+        dirtyChunks changed since they were last saved.
+    */
+    virtual int chunkCount()
+    {
+        return dirtyChunks.size();
+    }
+
+    virtual int chunkBytes()
+    {
+        return HEX_CHUNK_TILES * sizeof(float);
+    }
+
+    // copies chunk c into data and returns its bytes
+    virtual int saveChunk(int c, char *data)
+    {
+        int first = c << HEX_CHUNK_BITS;
+        int count = std::min(HEX_CHUNK_TILES, length - first);
+        std::memcpy(data, &voltages[first], count * sizeof(float));
+        dirtyChunks[c] = 0;
+        return count * sizeof(float);
+    }
+
+    virtual void loadChunk(int c, const char *data, int bytes)
+    {
+        keepChunk(c);
+        int first = c << HEX_CHUNK_BITS;
+        int count = std::min(std::min(HEX_CHUNK_TILES, length - first), bytes / (int)sizeof(float));
+        std::memcpy(&voltages[first], data, count * sizeof(float));
+        ringSumCursor = -1;
+    }
+
+    /*
+        The buffer as one run of volts, for WAV import and export. A fill of
+        at most fillLength replaces it from the start and leaves every chunk
+        dirty. copyChunk gives a chunk's volts without saving it, and
+        returns how many.
+    */
+    virtual int fillLength()
+    {
+        return length;
+    }
+
+    virtual void fill(const float *v, int count)
+    {
+        count = clamp(count, 0, length);
+        std::copy(v, v + count, voltages.begin());
+        std::fill(voltages.begin() + count, voltages.end(), 0.f);
+        std::fill(dirtyChunks.begin(), dirtyChunks.end(), 1);
+        ringSumCursor = -1;
     }
 
-    float getRingVoltage()
+    virtual int copyChunk(int c, float *v)
     {
-        float voltage = getTileVoltage(readCursor);
+        int first = c << HEX_CHUNK_BITS;
+        int count = std::min(HEX_CHUNK_TILES, length - first);
+        std::copy(&voltages[first], &voltages[first] + count, v);
+        return count;
+    }
 
-        for (const auto &offset : ringOffsets)
+    // tiles each chunk holds, 1 where a tile is a run of samples
+    virtual int chunkTiles()
+    {
+        return HEX_CHUNK_TILES;
+    }
+
+    // copyChunk the other way, into a hex that isn't running yet
+    virtual void fillChunk(int c, const float *v, int count)
+    {
+        int first = c << HEX_CHUNK_BITS;
+        count = std::min(count, std::min(HEX_CHUNK_TILES, length - first));
+        std::copy(v, v + count, &voltages[first]);
+        dirtyChunks[c] = 1;
+        ringSumCursor = -1;
+    }
+
+    /*
+        Trades buffers with other, a hex of the same kind and radius, so the
+        audio thread takes up one made on a worker in a few pointer moves and
+        the cursors carry on where they were. Every chunk is left dirty.
+    */
+    virtual void swapBuffer(Hex &other)
+    {
+        for (int c = 0; c < (int)snapshotPending.size(); c++)
+            keepChunk(c);
+        voltages.swap(other.voltages);
+        std::fill(dirtyChunks.begin(), dirtyChunks.end(), 1);
+        ringSumCursor = -1;
+    }
+
+    /*
+        A bank of snapshots of the buffer, taken and recalled on the audio
+        thread without copying it. A capture marks every chunk as shared with
+        the slot, and a chunk is copied for the slots sharing it only when it
+        is about to change, so a snapshot holds just the chunks written since,
+        and slots captured between two writes share one copy. Recall brings
+        back the chunks that differ, see prepareRecall. Snapshots live as long
+        as the hex.
+    */
+    virtual void captureSnapshot(int s)
+    {
+        clearTileSnapshot(s);
+        for (int c = 0; c < (int)snapshotPending.size(); c++)
         {
-            int i = getReadIndexAtOffset(offset);
-            voltage += getTileVoltage(i);
+            pendingChunks += snapshotPending[c] == 0;
+            snapshotPending[c] |= 1 << s;
         }
+        snapshotCaptured[s] = true;
+    }
 
-        return voltage / sqrt(ringOffsets.size());
+    // false if slot s holds nothing
+    virtual bool recallSnapshot(int s)
+    {
+        if (!prepareRecall(s))
+            return false;
+        stageRecall();
+        publishRecall();
+        return true;
     }
 
-    void decayTile(int i)
+    // whether recall copies the buffer, and so is worth staging, see prepareRecall
+    virtual bool recallCopies()
     {
-        tiles[i].writ *= .75;
-        tiles[i].read *= .75;
+        return true;
     }
 
-    Tile getTile(int i)
+    /*
+        A recall in three steps, so the copying stays off the audio thread.
+        prepareRecall, on the audio thread, notes which chunks slot s has
+        copies of. stageRecall builds the recalled buffer from those and the
+        buffer's own chunks on a worker. publishRecall swaps it in on the
+        audio thread, after taking any chunk written meanwhile from the copy
+        keepChunk made of it first. Until publishRecall the slot must stay,
+        and a slot dropped by keepChunk meanwhile is not recalled.
+    */
+    bool prepareRecall(int s)
     {
-        return tiles[wrap(i, length)];
+        if (!snapshotCaptured[s])
+            return false;
+        recallSlot = s;
+        recallChunks = snapshotChunks[s];
+        return true;
     }
 
-    Tile getReadTile()
+    void stageRecall()
     {
-        return tiles[readCursor];
+        recallBuffer.resize(length);
+        for (int c = 0; c < (int)recallChunks.size(); c++)
+        {
+            int first = c << HEX_CHUNK_BITS;
+            const float *from = recallChunks[c] ? recallChunks[c] : &voltages[first];
+            std::copy(from, from + std::min(HEX_CHUNK_TILES, length - first), &recallBuffer[first]);
+        }
+    }
+
+    void publishRecall()
+    {
+        int s = recallSlot;
+        if (!snapshotCaptured[s])
+            return;
+
+        for (int c = 0; c < (int)snapshotPending.size(); c++)
+        {
+            float *kept = snapshotChunks[s][c];
+            if (!kept)
+                continue; // the buffer still holds what was captured
+
+            int first = c << HEX_CHUNK_BITS;
+            if (!recallChunks[c])
+                std::copy(kept, kept + std::min(HEX_CHUNK_TILES, length - first), &recallBuffer[first]);
+            keepChunk(c); // for the other slots still sharing it
+            dirtyChunks[c] = 1;
+        }
+        voltages.swap(recallBuffer);
+        ringSumCursor = -1;
     }
 
-    Tile getReadTileAtOffset(int offset)
+    virtual void clearSnapshot(int s)
     {
-        return getTile(getReadIndexAtOffset(offset));
+        clearTileSnapshot(s);
+    }
+
+    // copies chunk c for the slots still sharing it, before it changes
+    void keepChunk(int c)
+    {
+        uint8_t pending = snapshotPending[c];
+        if (!pending)
+            return;
+
+        // out of blocks, the slots sharing the chunk are dropped rather than
+        // left to see the write, see snapshotsDropped
+        GrainPool &pool = GrainPool::shared();
+        float *copy = static_cast<float *>(pool.allocate(GrainPool::classFor(HEX_CHUNK_TILES * sizeof(float))));
+        if (!copy)
+        {
+            for (int s = 0; s < SNAPSHOT_SLOTS; s++)
+            {
+                if (pending & (1 << s))
+                    clearTileSnapshot(s);
+            }
+            snapshotsDropped |= pending;
+            return;
+        }
+        int first = c << HEX_CHUNK_BITS;
+        std::copy(&voltages[first], &voltages[first] + std::min(HEX_CHUNK_TILES, length - first), copy);
+
+        for (int s = 0; s < SNAPSHOT_SLOTS; s++)
+        {
+            if (pending & (1 << s))
+                snapshotChunks[s][c] = copy;
+        }
+        snapshotPending[c] = 0;
+        pendingChunks--;
+    }
+
+    void clearTileSnapshot(int s)
+    {
+        for (int c = 0; c < (int)snapshotPending.size(); c++)
+        {
+            if (snapshotPending[c] & (1 << s))
+            {
+                snapshotPending[c] &= ~(1 << s);
+                pendingChunks -= snapshotPending[c] == 0;
+            }
+
+            float *kept = snapshotChunks[s][c];
+            snapshotChunks[s][c] = nullptr;
+            if (kept && !chunkKept(c, kept))
+                GrainPool::shared().release(kept, GrainPool::classFor(HEX_CHUNK_TILES * sizeof(float)));
+        }
+        snapshotCaptured[s] = false;
+    }
+
+    // whether any slot holds copy as its chunk c
+    bool chunkKept(int c, const float *copy)
+    {
+        for (int s = 0; s < SNAPSHOT_SLOTS; s++)
+        {
+            if (snapshotChunks[s][c] == copy)
+                return true;
+        }
+        return false;
     }
 
     int getReadIndexAtOffset(int offset)
@@ -219,101 +800,215 @@ struct Hex
                 ringOffsets.push_back(top);
             }
         }
+
+        updateRingTaps();
+    }
+
+    // after the ring or readLength change, invalidates the ring sum
+    void updateRingTaps()
+    {
+        for (int tap : ringTaps)
+            ringTapCounts[tap] = 0;
+        ringTaps.clear();
+
+        for (int offset : ringOffsets)
+        {
+            int tap = wrap(offset, readLength);
+            ringTaps.push_back(tap);
+            ringTapCounts[tap]++;
+        }
+
+        ringScale = ringOffsets.empty() ? 1 : 1 / sqrt(ringOffsets.size());
+        ringSumCursor = -1;
     }
 
     virtual void advanceWriteCursor(float x, float y, float z)
     {
-        writeX += x;
-        writeY += y;
-        writeZ += z;
+        placeWriteCursor(moveWriteVector(x, y, z));
+    }
 
-        writeX = fmod(writeX, length);
-        writeY = fmod(writeY, length);
-        writeZ = fmod(writeZ, length);
+    virtual void advanceReadCursor(float x, float y, float z)
+    {
+        placeReadCursor(moveReadVector(x, y, z));
+    }
 
-        int writeVectorCursor = round(writeX) + round(writeY) * y_step + round(writeZ) * z_step;
+    // moves the write vector position and returns the tile it lands on
+    int moveWriteVector(float x, float y, float z)
+    {
+        return moveVector(writePhase, x, y, z);
+    }
 
-        if (writeMode == RING || writeMode == VORTEX)
-        {
-            writeRingCursor += ringDirs[writePosRingDir];
-            bool isRingEdgeComplete = ++writePosRingStep >= (writeMode == RING ? writeMaxRadius : writePosRingRadius);
-            if (isRingEdgeComplete)
-            {
-                writePosRingStep = 0;
-                writePosRingDir++; // change to next edge direction
+    int moveReadVector(float x, float y, float z)
+    {
+        return moveVector(readPhase, x, y, z);
+    }
 
-                bool isRingComplete = writePosRingDir == static_cast<int>(ringDirs.size());
-                if (isRingComplete && writeMode == VORTEX)
-                {
-                    // increase radius in vortex mode
-                    writePosRingRadius++;
-                    writePosRingRadius %= writeMaxRadius;
-                }
-                writePosRingDir %= ringDirs.size();
-            }
-            writeRingCursor = wrap(writeRingCursor, writeLength);
-        }
+    int moveVector(VectorPhase &phase, float x, float y, float z)
+    {
+        phase.x = wrapPhase(phase.x + toPhaseStep(x));
+        phase.y = wrapPhase(phase.y + toPhaseStep(y));
+        phase.z = wrapPhase(phase.z + toPhaseStep(z));
 
-        writeCursor = wrap(writeVectorCursor + writeRingCursor, writeLength);
+        return phaseToTile(phase.x) + phaseToTile(phase.y) * y_step + phaseToTile(phase.z) * z_step;
     }
 
-    virtual void advanceReadCursor(float x, float y, float z)
+    // steps stay under half a lap, so one compare keeps the phase in range
+    int64_t toPhaseStep(float v)
     {
-        readX += x;
-        readY += y;
-        readZ += z;
+        float limit = length / 2.f;
+        return int64_t(double(clamp(v, -limit, limit)) * CURSOR_ONE);
+    }
 
-        readX = fmod(readX, length);
-        readY = fmod(readY, length);
-        readZ = fmod(readZ, length);
+    int64_t wrapPhase(int64_t phase)
+    {
+        return phase >= phaseLength ? phase - phaseLength : (phase < 0 ? phase + phaseLength : phase);
+    }
 
-        int readVectorCursor = round(readX) + round(readY) * y_step + round(readZ) * z_step;
+    // nearest tile, halves round up
+    int phaseToTile(int64_t phase)
+    {
+        return int((phase + CURSOR_ONE / 2) >> CURSOR_FRACTION_BITS);
+    }
 
-        if (readMode == RING || readMode == VORTEX)
+    // steps the write ring in RING and VORTEX modes and sets the write cursor from it
+    void placeWriteCursor(int writeVectorCursor)
+    {
+        switch (writeMode)
         {
-            readRingCursor += ringDirs[readPosRingDir];
-            bool isRingEdgeComplete = ++readPosRingStep >= (readMode == RING ? readMaxRadius : readPosRingRadius);
-            if (isRingEdgeComplete)
-            {
-                readPosRingStep = 0;
-                readPosRingDir++; // change to next edge direction
+        case RING:
+            return placeWriteCursor<RING>(writeVectorCursor);
+        case VORTEX:
+            return placeWriteCursor<VORTEX>(writeVectorCursor);
+        default:
+            return placeWriteCursor<VECTOR>(writeVectorCursor);
+        }
+    }
 
-                bool isRingComplete = readPosRingDir == static_cast<int>(ringDirs.size());
-                if (isRingComplete && readMode == VORTEX)
-                {
-                    // increase radius in vortex mode
-                    readPosRingRadius++;
-                    readPosRingRadius %= readMaxRadius;
-                }
-                readPosRingDir %= ringDirs.size();
-            }
-            readRingCursor = wrap(readRingCursor, readLength);
+    template <Mode M>
+    void placeWriteCursor(int writeVectorCursor)
+    {
+        if (M != VECTOR)
+            stepRing<M>(writeWalk, writeMaxRadius, writeLength);
+
+        writeCursor = wrap(writeVectorCursor + writeWalk.cursor, writeLength);
+    }
+
+    // steps the read ring in RING and VORTEX modes and sets the read cursor from it
+    void placeReadCursor(int readVectorCursor)
+    {
+        switch (readMode)
+        {
+        case RING:
+            return placeReadCursor<RING>(readVectorCursor);
+        case VORTEX:
+            return placeReadCursor<VORTEX>(readVectorCursor);
+        default:
+            return placeReadCursor<VECTOR>(readVectorCursor);
+        }
+    }
+
+    template <Mode M>
+    void placeReadCursor(int readVectorCursor)
+    {
+        if (M != VECTOR)
+            stepRing<M>(readWalk, readMaxRadius, readLength);
+
+        readCursor = wrap(readVectorCursor + readWalk.cursor, readLength);
+    }
+
+    void stepRing(Mode mode, RingWalk &walk, int maxRadius, int wrapLength)
+    {
+        if (mode == VORTEX)
+            stepRing<VORTEX>(walk, maxRadius, wrapLength);
+        else
+            stepRing<RING>(walk, maxRadius, wrapLength);
+    }
+
+    /*
+        One step along a ring, or a vortex that grows by a ring on every lap.
+        Every lap closes on itself, so a step is a lookup into the lap's
+        offsets from where it started. Radius changes land on the next lap.
+    */
+    template <Mode M>
+    void stepRing(RingWalk &walk, int maxRadius, int wrapLength)
+    {
+        if (walk.lapStep == 0)
+        {
+            walk.lapStart = walk.cursor;
+            walk.lapRadius = M == RING ? maxRadius : std::max(walk.vortexRadius, 1);
         }
 
-        readCursor = wrap(readVectorCursor + readRingCursor, readLength);
+        const std::vector<int> &lap = (*laps)[walk.lapRadius];
+        walk.cursor = wrap(walk.lapStart + lap[walk.lapStep], wrapLength);
+
+        if (++walk.lapStep == static_cast<int>(lap.size()))
+        {
+            walk.lapStep = 0;
+            if (M == VORTEX)
+                walk.vortexRadius = (walk.vortexRadius + 1) % maxRadius;
+        }
     }
 
     int wrap(int x, int wrapLength)
     {
-        while (x < 0)
-            x += wrapLength;
         x %= wrapLength;
-        return x;
+        return x < 0 ? x + wrapLength : x;
     }
 
     void initTiles()
     {
-        tiles.resize(length);
+        voltages.assign(length, 0);
+        dirtyChunks.assign((length + HEX_CHUNK_TILES - 1) >> HEX_CHUNK_BITS, 0);
+        snapshotPending.assign(dirtyChunks.size(), 0);
+        for (std::vector<float *> &chunks : snapshotChunks)
+            chunks.assign(dirtyChunks.size(), nullptr);
+        recallChunks.assign(dirtyChunks.size(), nullptr);
+
+        // positions and laps only depend on radius, so each radius is laid out once
+        struct Layout
+        {
+            std::vector<TilePosition> positions;
+            std::vector<std::vector<int>> laps;
+            PyramidLayout pyramid;
+        };
 
-        for (int i = 0; i < length; ++i)
+        static std::mutex layoutsMutex;
+        static std::map<int, Layout> layouts;
+
+        std::lock_guard<std::mutex> lock(layoutsMutex);
+        Layout &layout = layouts[radius];
+        if (layout.positions.empty())
         {
-            std::array<float, 2> c = coordAt(i);
-            tiles[i].x = c[0];
-            tiles[i].y = c[1];
-            tiles[i].v = 0;
-            tiles[i].writ = 0;
-            tiles[i].read = 0;
+            layout.positions.resize(length);
+            for (int i = 0; i < length; ++i)
+            {
+                std::array<float, 2> c = coordAt(i);
+                layout.positions[i].x = c[0];
+                layout.positions[i].y = c[1];
+            }
+
+            // a lap of radius r walks r tiles in each ring direction, ending where it began
+            layout.laps.resize(radius + 1);
+            for (int r = 1; r <= radius; r++)
+            {
+                int offset = 0;
+                for (int dir : ringDirs)
+                {
+                    for (int step = 0; step < r; step++)
+                    {
+                        offset += dir;
+                        layout.laps[r].push_back(offset);
+                    }
+                }
+            }
         }
+        // cells start at about two tiles across
+        if (layout.pyramid.levels == 0)
+            layout.pyramid.build(layout.positions.data(), length, 2 * dy, std::max(width, height));
+
+        positions = layout.positions.data();
+        laps = &layout.laps;
+        pyramidLayout = &layout.pyramid;
     }
 
     std::array<float, 2> coordAt(int i)
@@ -333,4 +1028,63 @@ struct Hex
         return x < 0 ? getCoords(x + yAxis + 1, y, z + 1) : x < radius ? std::array<int, 3>{x, y, z}
                                                                        : getCoords(x - yAxis, y + 1, z);
     }
-};
\ No newline at end of file
+};
+
+/*
+    A Hex whose writes keep only what Storage can hold. Tiles stay floats, as
+    the display and read heads read them directly and a voice's tiles are a
+    small part of its memory, so this is for the sound of the lower precision.
+*/
+
+template <typename Storage>
+struct StoredHex : Hex
+{
+    StoredHex(int r) : Hex(r)
+    {
+    }
+
+    void setVoltage(float v, float blend) override
+    {
+        blend = clamp(blend, 0.0, 1.0);
+        writeTile(writeCursor, Storage::toFloat(Storage::fromFloat(v * blend + voltages[writeCursor] * (1.0 - blend))));
+    }
+
+    void fill(const float *v, int count) override
+    {
+        Hex::fill(v, count);
+        for (float &tile : voltages)
+            tile = Storage::toFloat(Storage::fromFloat(tile));
+    }
+
+    void fillChunk(int c, const float *v, int count) override
+    {
+        Hex::fillChunk(c, v, count);
+        int first = c << HEX_CHUNK_BITS;
+        for (int i = first; i < std::min(first + HEX_CHUNK_TILES, length); i++)
+            voltages[i] = Storage::toFloat(Storage::fromFloat(voltages[i]));
+    }
+
+    void processBlock(const float *in, float *out, int n, const CursorParams &p) override
+    {
+        processBlockAs<Storage>(in, out, n, p);
+    }
+
+    SampleKernel sampleKernel() override
+    {
+        return sampleKernelFor<Storage>(writeMode, readMode, ringRadius >= 1);
+    }
+};
+
+// a HexNut voice's hex of radius r, storing samples as format
+inline Hex *createStoredHex(int r, SampleFormat format)
+{
+    switch (format)
+    {
+    case FIXED16_SAMPLES:
+        return new StoredHex<Fixed16Samples>(r);
+    case HALF_SAMPLES:
+        return new StoredHex<HalfSamples>(r);
+    default:
+        return new Hex(r);
+    }
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include "Hex.hpp"
+#include "JobPool.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/*
+    Makes hexes for voices that start playing, on a JobPool worker, as a hex
+    is too big to allocate on the audio thread. The audio thread says how many
+    voices it plays and how many it has hexes for, and takes a finished build
+    between samples. The upkeep thread starts builds and frees the ones the
+    audio thread had no use for, as when the hexes were replaced meanwhile.
+*/
+
+struct HexBuilder
+{
+    enum State
+    {
+        IDLE,
+        BUILDING, // the worker's
+        READY,    // the audio thread's
+        TAKEN,    // the upkeep thread's, to clear
+    };
+
+    std::atomic<int> state{IDLE};
+    std::atomic<int> wanted{0};
+    std::atomic<int> have{0};
+
+    // voices first on, built in format
+    std::vector<std::unique_ptr<Hex>> hexes;
+    int first = 0;
+    SampleFormat format = FLOAT_SAMPLES;
+
+    ~HexBuilder()
+    {
+        stop();
+    }
+
+    // waits for a build that already started, once upkeep no longer runs
+    void stop()
+    {
+        if (JobPool::shared().cancel(this))
+            state = IDLE;
+        while (state.load(std::memory_order_acquire) == BUILDING)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    // audio thread, every sample
+    void want(int voices, int built)
+    {
+        wanted.store(voices, std::memory_order_relaxed);
+        have.store(built, std::memory_order_relaxed);
+    }
+
+    // upkeep thread, hexes in f for the voices the audio thread is missing
+    void update(Hex *(*createHex)(SampleFormat), SampleFormat f)
+    {
+        if (state.load(std::memory_order_acquire) == TAKEN)
+        {
+            hexes.clear();
+            state.store(IDLE, std::memory_order_relaxed);
+        }
+
+        int from = have.load(std::memory_order_relaxed);
+        int to = wanted.load(std::memory_order_relaxed);
+        if (state.load(std::memory_order_relaxed) != IDLE || to <= from)
+            return;
+
+        first = from;
+        format = f;
+        state.store(BUILDING, std::memory_order_relaxed);
+        JobPool::shared().run(this, [=]()
+                              {
+                                  for (int v = from; v < to; v++)
+                                      hexes.push_back(std::unique_ptr<Hex>(createHex(f)));
+                                  state.store(READY, std::memory_order_release);
+                              });
+    }
+
+    // audio thread, appends a finished build to voiceHexes if it was made to
+    // follow them in f, which has room reserved for it
+    bool take(std::vector<std::unique_ptr<Hex>> &voiceHexes, SampleFormat f)
+    {
+        if (state.load(std::memory_order_acquire) != READY)
+            return false;
+
+        bool fits = first == (int)voiceHexes.size() && format == f;
+        if (fits)
+        {
+            for (std::unique_ptr<Hex> &hex : hexes)
+                voiceHexes.push_back(std::move(hex));
+        }
+        state.store(TAKEN, std::memory_order_release);
+        return fits;
+    }
+};
@@ -0,0 +1,289 @@
+#pragma once
+#include "Hex.hpp"
+#include "ReadHeads.hpp"
+
+/*
+    Control values for one sample, after any CV has been summed in. Laid out
+    after HexNut's ParamId so modules and offline renderers fill it the same way.
+*/
+
+struct HexControls
+{
+    float writeMode = 1;
+    float readMode = 1;
+    float writeRadius = 1;
+    float readRadius = 1;
+    float grainSize = 1;
+    float writeX = 0;
+    float writeY = 0;
+    float writeZ = 0;
+    float readX = 0;
+    float readY = 0;
+    float readZ = 0;
+    float blend = 1;
+    float readRing = 0;
+    float crop = 1;
+};
+
+/*
+    Values set at control rate and ramped linearly at audio rate so they land on
+    their targets by the next update. T is float for one voice, or a SIMD vector
+    for several voices at once.
+*/
+
+template <typename T, int N>
+struct ControlRamp
+{
+    T values[N];
+    T targets[N];
+    T steps[N];
+    int remaining = 0;
+    bool primed = false;
+
+    ControlRamp()
+    {
+        std::fill(values, values + N, T(0.f));
+        std::fill(targets, targets + N, T(0.f));
+        std::fill(steps, steps + N, T(0.f));
+    }
+
+    // call after writing targets, the first call jumps straight to them
+    void start(int rampLength)
+    {
+        if (!primed || rampLength < 2)
+        {
+            std::copy(targets, targets + N, values);
+            remaining = 0;
+            primed = true;
+            return;
+        }
+
+        for (int i = 0; i < N; i++)
+            steps[i] = (targets[i] - values[i]) / float(rampLength);
+        remaining = rampLength;
+    }
+
+    void process()
+    {
+        if (remaining > 0)
+        {
+            for (int i = 0; i < N; i++)
+                values[i] += steps[i];
+
+            // land exactly on the targets
+            if (--remaining == 0)
+                std::copy(targets, targets + N, values);
+        }
+    }
+};
+
+/*
+    The DSP behind HexNut and HexaGrain, kept free of Module and ProcessArgs so
+    it can run outside of Rack.
+*/
+
+struct HexEngine
+{
+    Hex *hex;
+
+    // extra heads on the read cursor, see setHeads, and a read x offset, see voiceDrift
+    ReadHeads heads;
+    float readDrift = 0;
+
+    float lastReadRingRadius = 0;
+    float lastCrop = 1;
+    float grainSize = 1; // set on every sample, a grain takes it when it starts
+
+    // the hex's one-sample kernel for the current modes and spread, picked by applyControls
+    Hex::SampleKernel kernel = nullptr;
+
+    // vectors and blend, ramped at audio rate between control rate updates
+    enum Smoothed
+    {
+        WRITE_X,
+        WRITE_Y,
+        WRITE_Z,
+        READ_X,
+        READ_Y,
+        READ_Z,
+        BLEND,
+        SMOOTHED_LEN
+    };
+
+    ControlRamp<float, SMOOTHED_LEN> ramp;
+
+    HexEngine(Hex *hex) : hex(hex)
+    {
+    }
+
+    /*
+        Control rate half of the smoothed path. Applies structural changes right
+        away and ramps vectors and blend to their new values over rampLength
+        samples of process(in). The first call jumps straight to the values.
+    */
+    void setControls(const HexControls &c, int rampLength)
+    {
+        applyControls(c);
+
+        setTargets(ramp.targets, c);
+        ramp.start(rampLength);
+    }
+
+    // the smoothed controls of c, in Smoothed order, with the drift
+    void setTargets(float *targets, const HexControls &c)
+    {
+        targets[WRITE_X] = c.writeX;
+        targets[WRITE_Y] = c.writeY;
+        targets[WRITE_Z] = c.writeZ;
+        targets[READ_X] = c.readX + readDrift;
+        targets[READ_Y] = c.readY;
+        targets[READ_Z] = c.readZ;
+        targets[BLEND] = c.blend;
+    }
+
+    // read x offset of a module's voices, 1, 2, 3, 4... read at +1, -1, +2, -2... steps of drift
+    static float voiceDrift(int voice, float drift)
+    {
+        return drift * ((voice + 1) / 2 * (voice % 2 ? 1 : -1));
+    }
+
+    // count extra heads besides the read cursor, new ones start on it
+    void setHeads(int count)
+    {
+        heads.setCount(count, *hex);
+    }
+
+    // audio rate half of the smoothed path, see setControls
+    float process(float in)
+    {
+        float headsOut[MAX_READ_HEADS + 1];
+        ramp.process();
+        return step(in, ramp.values, headsOut);
+    }
+
+    /*
+        n samples of the smoothed path. Once the ramp has landed, and with no
+        extra heads, the params hold until the next setControls, so the rest
+        of the samples go through the hex's block kernels.
+    */
+    void process(const float *in, float *out, int n)
+    {
+        int i = 0;
+        for (; i < n && (ramp.remaining > 0 || heads.count > 0); i++)
+            out[i] = process(in[i]);
+
+        if (i < n)
+            hex->processBlock(in + i, out + i, n - i, params(ramp.values));
+    }
+
+    // the smoothed values v, in Smoothed order, and the grain size
+    CursorParams params(const float *v)
+    {
+        CursorParams p;
+        p.writeX = v[WRITE_X];
+        p.writeY = v[WRITE_Y];
+        p.writeZ = v[WRITE_Z];
+        p.readX = v[READ_X];
+        p.readY = v[READ_Y];
+        p.readZ = v[READ_Z];
+        p.blend = v[BLEND];
+        p.grainSize = grainSize;
+        return p;
+    }
+
+    /*
+        One sample with the smoothed values v, in Smoothed order, however
+        they were ramped. headsOut gets the read cursor's tile then each extra
+        head's, and the output is their mix.
+    */
+    float step(float in, const float *v, float *headsOut)
+    {
+        CursorParams p = params(v);
+
+        // i/o and cursors, and the grain size for grains
+        float out = (hex->*kernel)(in, p);
+
+        headsOut[0] = out;
+        if (heads.count > 0)
+        {
+            out = (out + heads.read(*hex, headsOut + 1)) / std::sqrt(heads.count + 1.f);
+            heads.advance(*hex, p.readX, p.readY, p.readZ);
+        }
+
+        return out;
+    }
+
+    // all controls applied on every sample, with no smoothing
+    float process(float in, const HexControls &c)
+    {
+        applyControls(c);
+
+        // i/o
+
+        hex->setVoltage(in, c.blend);
+        float out = hex->getVoltage();
+
+        // cursors
+
+        hex->advanceWriteCursor(c.writeX, c.writeY, c.writeZ);
+        hex->advanceReadCursor(c.readX, c.readY, c.readZ);
+
+        // grains, a no-op for plain hexes
+
+        hex->setSize(c.grainSize);
+
+        return out;
+    }
+
+    // n samples with the same controls, identical to n calls to process
+    void processBlock(const float *in, float *out, int n, const HexControls &c)
+    {
+        applyControls(c);
+
+        CursorParams p;
+        p.writeX = c.writeX;
+        p.writeY = c.writeY;
+        p.writeZ = c.writeZ;
+        p.readX = c.readX;
+        p.readY = c.readY;
+        p.readZ = c.readZ;
+        p.blend = c.blend;
+        p.grainSize = c.grainSize;
+
+        hex->processBlock(in, out, n, p);
+    }
+
+    void applyControls(const HexControls &c)
+    {
+        // modes
+
+        hex->writeMode = hex->floatToMode(c.writeMode);
+        hex->readMode = hex->floatToMode(c.readMode);
+
+        grainSize = c.grainSize;
+
+        // crop
+
+        if (c.crop != lastCrop)
+        {
+            hex->setCrop(c.crop);
+            lastCrop = c.crop;
+        }
+
+        // rings
+
+        hex->setWriteMaxRadius(c.writeRadius);
+        hex->setReadMaxRadius(c.readRadius);
+
+        if (c.readRing != lastReadRingRadius)
+        {
+            hex->ringRadius = round(c.readRing);
+            hex->updateReadRingOffsets();
+            lastReadRingRadius = c.readRing;
+        }
+
+        // picked last, once the modes and spread are set
+
+        kernel = hex->sampleKernel();
+    }
+};
@@ -1,6 +1,9 @@
+#pragma once
 #include "plugin.hpp"
 #include "UI.hpp"
 
+static const std::vector<int> UPDATE_DIVISIONS = {1, 4, 16, 64};
+
 struct HexExCV : Module
 {
     enum ParamId
@@ -29,6 +32,44 @@ struct HexExCV : Module
         LIGHTS_LEN
     };
 
+    // a HexExSnap's inputs, see Message::snapshot
+    enum SnapshotInput
+    {
+        SNAPSHOT_CAPTURE,
+        SNAPSHOT_RECALL,
+        SNAPSHOT_SLOT,
+        SNAPSHOT_INPUTS_LEN
+    };
+
+    /*
+        CV for the HexNut or HexaGrain to our left, written into its right
+        expander message buffers. Rack flips the buffers between frames, so the
+        host always reads a complete set, whichever thread each module runs on.
+        A HexExSnap writes the same message, to the host or to us on its left,
+        and we pass its snapshot voltages on.
+    */
+    struct Message
+    {
+        float voltages[INPUTS_LEN][PORT_MAX_CHANNELS] = {};
+        int channels[INPUTS_LEN] = {};
+        float snapshot[SNAPSHOT_INPUTS_LEN] = {};
+
+        // the voice's channel, with mono CV shared by all voices
+        float getVoltage(int input, int voice) const
+        {
+            int c = channels[input];
+            return c == 1 ? voltages[input][0] : voice < c ? voltages[input][voice] : 0.f;
+        }
+    };
+
+    // a message is written every updateDivider samples
+    dsp::ClockDivider updateDivider;
+
+    // written by a HexExSnap on our right, and the highest trigger voltages
+    // since the last message, so a trigger between two still gets through
+    Message snapMessages[2];
+    float heldTriggers[SNAPSHOT_SLOT] = {};
+
     HexExCV()
     {
         config(PARAMS_LEN, INPUTS_LEN, OUTPUTS_LEN, LIGHTS_LEN);
@@ -46,10 +87,63 @@ struct HexExCV : Module
         configInput(CV_READ_SIZE_INPUT, "CV Read Vortex Size");
 
         configInput(CV_BLEND_INPUT, "CV Blend");
+
+        getRightExpander().producerMessage = &snapMessages[0];
+        getRightExpander().consumerMessage = &snapMessages[1];
+    }
+
+    json_t *dataToJson() override
+    {
+        json_t *rootJ = json_object();
+        json_object_set_new(rootJ, "updateDivision", json_integer(updateDivider.getDivision()));
+        return rootJ;
+    }
+
+    void dataFromJson(json_t *rootJ) override
+    {
+        json_t *updateDivisionJ = json_object_get(rootJ, "updateDivision");
+        if (updateDivisionJ)
+        {
+            int division = json_integer_value(updateDivisionJ);
+            if (std::find(UPDATE_DIVISIONS.begin(), UPDATE_DIVISIONS.end(), division) != UPDATE_DIVISIONS.end())
+                updateDivider.setDivision(division);
+        }
     }
 
     void process(const ProcessArgs &args) override
     {
+        Module *host = getLeftExpander().module;
+        if (!host || (host->model != modelHexNut && host->model != modelHexaGrain))
+            return;
+
+        Module *snap = getRightExpander().module;
+        const Message *snapMessage = snap && snap->model == modelHexExSnap ? (const Message *)getRightExpander().consumerMessage : nullptr;
+        for (int i = 0; i < SNAPSHOT_SLOT; i++)
+            heldTriggers[i] = std::max(heldTriggers[i], snapMessage ? snapMessage->snapshot[i] : 0.f);
+
+        if (!updateDivider.process())
+            return;
+
+        Message *message = (Message *)host->getRightExpander().producerMessage;
+        if (!message)
+            return;
+
+        for (int i = 0; i < INPUTS_LEN; i++)
+        {
+            int channels = inputs[i].getChannels();
+            message->channels[i] = channels;
+            for (int c = 0; c < channels; c++)
+                message->voltages[i][c] = inputs[i].getVoltage(c);
+        }
+
+        for (int i = 0; i < SNAPSHOT_SLOT; i++)
+        {
+            message->snapshot[i] = heldTriggers[i];
+            heldTriggers[i] = 0.f;
+        }
+        message->snapshot[SNAPSHOT_SLOT] = snapMessage ? snapMessage->snapshot[SNAPSHOT_SLOT] : 0.f;
+
+        host->getRightExpander().requestMessageFlip();
     }
 };
 
@@ -74,6 +168,28 @@ struct HexExCVWidget : ModuleWidget
 
         addInput(createInput<FlatPort>((Vec(10, 346)), module, HexExCV::CV_BLEND_INPUT));
     }
+
+    void appendContextMenu(Menu *menu) override
+    {
+        HexExCV *module = dynamic_cast<HexExCV *>(this->module);
+        if (!module)
+            return;
+
+        std::vector<std::string> labels;
+        for (int division : UPDATE_DIVISIONS)
+            labels.push_back(division == 1 ? "Every sample" : string::f("Every %d samples", division));
+
+        menu->addChild(new MenuSeparator);
+        menu->addChild(createIndexSubmenuItem(
+            "Update rate", labels,
+            [=]()
+            {
+                auto it = std::find(UPDATE_DIVISIONS.begin(), UPDATE_DIVISIONS.end(), (int)module->updateDivider.getDivision());
+                return it - UPDATE_DIVISIONS.begin();
+            },
+            [=](size_t i)
+            { module->updateDivider.setDivision(UPDATE_DIVISIONS[i]); }));
+    }
 };
 
 Model *modelHexExCV = createModel<HexExCV, HexExCVWidget>("HexExCV");
\ No newline at end of file
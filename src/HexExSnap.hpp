@@ -0,0 +1,81 @@
+#pragma once
+#include "plugin.hpp"
+#include "UI.hpp"
+#include "HexExCV.hpp"
+
+struct HexExSnap : Module
+{
+    enum ParamId
+    {
+        PARAMS_LEN
+    };
+    enum InputId
+    {
+        CAPTURE_INPUT,
+        RECALL_INPUT,
+        SLOT_INPUT,
+        INPUTS_LEN
+    };
+    enum OutputId
+    {
+        OUTPUTS_LEN
+    };
+    enum LightId
+    {
+        LIGHTS_LEN
+    };
+
+    static_assert((int)INPUTS_LEN == (int)HexExCV::SNAPSHOT_INPUTS_LEN, "an input per HexExCV::SnapshotInput");
+
+    HexExSnap()
+    {
+        config(PARAMS_LEN, INPUTS_LEN, OUTPUTS_LEN, LIGHTS_LEN);
+
+        configInput(CAPTURE_INPUT, "Capture snapshot trigger");
+        configInput(RECALL_INPUT, "Recall snapshot trigger");
+        configInput(SLOT_INPUT, "Snapshot slot, 1V per slot from 0V");
+    }
+
+    /*
+        Snapshot triggers for the HexNut or HexaGrain to our left, or for the
+        HexExCV between us, which passes them on. Written every sample, so
+        triggers reach the host as they come.
+    */
+    void process(const ProcessArgs &args) override
+    {
+        Module *left = getLeftExpander().module;
+        if (!left)
+            return;
+        bool host = left->model == modelHexNut || left->model == modelHexaGrain;
+        if (!host && left->model != modelHexExCV)
+            return;
+
+        HexExCV::Message *message = (HexExCV::Message *)left->getRightExpander().producerMessage;
+        if (!message)
+            return;
+
+        // no CV, which a HexExCV there before may have left
+        if (host)
+            std::fill(message->channels, message->channels + HexExCV::INPUTS_LEN, 0);
+
+        for (int i = 0; i < INPUTS_LEN; i++)
+            message->snapshot[i] = inputs[i].getVoltage();
+
+        left->getRightExpander().requestMessageFlip();
+    }
+};
+
+struct HexExSnapWidget : ModuleWidget
+{
+    HexExSnapWidget(HexExSnap *module)
+    {
+        setModule(module);
+        setPanel(createPanel(asset::plugin(pluginInstance, "res/HexExSnap.svg")));
+
+        addInput(createInput<FlatPort>((Vec(10, 66)), module, HexExSnap::CAPTURE_INPUT));
+        addInput(createInput<FlatPort>((Vec(10, 122)), module, HexExSnap::RECALL_INPUT));
+        addInput(createInput<FlatPort>((Vec(10, 178)), module, HexExSnap::SLOT_INPUT));
+    }
+};
+
+Model *modelHexExSnap = createModel<HexExSnap, HexExSnapWidget>("HexExSnap");
@@ -1,8 +1,58 @@
 #include "plugin.hpp"
 #include "Hex.hpp"
 #include "GrainHex.hpp"
+#include "BufferStore.hpp"
+#include "HexBuilder.hpp"
+#include "HexEngine.hpp"
+#include "ReadHeads.hpp"
+#include "Upkeep.hpp"
 #include "UI.hpp"
 #include "HexExCV.hpp"
+#include "HexExSnap.hpp"
+
+#include <osdialog.h>
+
+static const std::vector<int> CONTROL_DIVISIONS = {1, 4, 8, 16, 32, 64, 128};
+static const int DEFAULT_CONTROL_DIVISION = 16;
+
+// in the patch storage directory, see BufferStore
+static const char *BUFFER_FILE = "buffers.bin";
+
+// read x offset per voice step, so polyphonic voices drift apart
+static const std::vector<float> VOICE_DRIFTS = {0.f, .001f, .01f};
+static const std::vector<std::string> VOICE_DRIFT_LABELS = {"Off", "Slight", "Wide"};
+
+static const std::vector<int> READ_HEAD_COUNTS = {1, 2, 4, MAX_READ_HEADS};
+
+// an extra head's vector in quarters of the read vector, and its mode from READ_HEAD_FOLLOW
+static const std::vector<int> READ_HEAD_SPEEDS = {-8, -6, -4, -2, -1, 0, 1, 2, 4, 6, 8};
+static const std::vector<std::string> READ_HEAD_SPEED_LABELS = {"-2x", "-1.5x", "-1x", "-0.5x", "-0.25x", "Still", "0.25x", "0.5x", "1x", "1.5x", "2x"};
+static const std::vector<std::string> READ_HEAD_MODE_LABELS = {"Read mode", "Vector", "Ring", "Vortex"};
+
+// RMS below which HexaGrain's read cursor skips a grain, in dB from 5V
+static const std::vector<float> GRAIN_SKIP_LEVELS = {0.f, .005f, .05f};
+static const std::vector<std::string> GRAIN_SKIP_LABELS = {"Off", "Below -60 dB", "Below -40 dB"};
+
+// by GrainDisplay
+static const std::vector<std::string> GRAIN_DISPLAY_LABELS = {"Level", "Peak", "Brightness"};
+
+// by SampleFormat
+static const std::vector<std::string> SAMPLE_FORMAT_LABELS = {"32-bit float", "16-bit fixed point", "16-bit half float"};
+
+static const char *WAV_FILTERS = "WAV:wav";
+
+// what a request from the Snapshots menu does to its slot, see HexNut::snapshotRequest
+enum SnapshotAction
+{
+    CAPTURE_SNAPSHOT,
+    RECALL_SNAPSHOT,
+    CLEAR_SNAPSHOT
+};
+
+// by BufferTransform
+static const std::vector<std::string> BUFFER_TRANSFORM_LABELS = {"Clear", "Reverse", "Normalize", "Shuffle tiles", "Smear along X", "Smear along Y", "Smear along Z", "Fade toward the edge", "Fade toward the center"};
+
+typedef ControlRamp<simd::float_4, HexEngine::SMOOTHED_LEN> VoiceRamp;
 
 struct HexNut : Module
 {
@@ -32,6 +82,7 @@ struct HexNut : Module
     enum OutputId
     {
         OUTPUT_OUTPUT,
+        HEADS_OUTPUT,
         OUTPUTS_LEN
     };
     enum LightId
@@ -39,16 +90,97 @@ struct HexNut : Module
         LIGHTS_LEN
     };
 
-    Hex _hex = Hex(86);
-    Hex *hex;
-    virtual Hex *getHex() { return &_hex; }
+    // makes the hex for one voice, so each module only builds the hexes it runs
+    typedef Hex *(*HexFactory)(SampleFormat format);
+
+    static Hex *createHex(SampleFormat format)
+    {
+        return createStoredHex(HEXNUT_RADIUS, format);
+    }
 
-    float lastReadRingRadius = 0;
-    float lastCrop = 1;
+    // a hex per voice, made the first time that voice plays, by voiceBuilder
+    // on the upkeep thread. Voices wait silently for theirs.
+    HexFactory hexFactory;
+    std::vector<std::unique_ptr<Hex>> voiceHexes;
+    HexBuilder voiceBuilder;
+    Hex *hex; // voice 0's, the one on the display
+
+    // the hexes' storage, and the one chosen from the menu, which the buffer
+    // moves into on a worker, see convertStorage
+    std::atomic<int> sampleFormat{FLOAT_SAMPLES};
+    std::atomic<int> nextSampleFormat{FLOAT_SAMPLES};
+
+    // hexes swapped out by process, freed by upkeep once the display, if
+    // there is one, draws displayHex rather than one of them
+    std::vector<std::unique_ptr<Hex>> retiredHexes;
+    std::atomic<bool> hexesRetired{false};
+    std::atomic<Hex *> displayHex{nullptr};
+    std::atomic<Hex *> drawnHex{nullptr};
+
+    // upkeep waits for onAdd, which sets the hexes up for the patch
+    std::atomic<bool> added{false};
+
+    // buffers saved with the patch, in chunks of at most maxChunkBytes, and
+    // at most maxChunks of them for every voice together
+    BufferStore store;
+    int maxChunkBytes;
+    int maxChunks;
+
+    // an action * SNAPSHOT_SLOTS + slot for process to carry out, or -1, and
+    // a bit for each slot holding a snapshot, for the menu
+    std::atomic<int> snapshotRequest{-1};
+    std::atomic<int> snapshotSlots{0};
+
+    // a recall of the hexes in recallHexes, staged by upkeep and swapped in
+    // at the start of a control block, see Hex::prepareRecall
+    enum RecallState
+    {
+        RECALL_IDLE,
+        RECALL_STAGING, // upkeep's
+        RECALL_STAGED   // the audio thread's
+    };
+    std::atomic<int> recallState{RECALL_IDLE};
+    Hex *recallHexes[PORT_MAX_CHANNELS] = {};
+    int recallCount = 0;
+    bool recallDiscarded = false; // the hexes were replaced meanwhile
+
+    // the expander's snapshot triggers, see processSnapshotTriggers
+    dsp::SchmittTrigger captureTrigger;
+    dsp::SchmittTrigger recallTrigger;
+
+    int maxVoices;
+    int channels = 1;
+    std::vector<HexEngine> engines;
+
+    // vectors and blend of four voices at a time
+    VoiceRamp voiceRamps[PORT_MAX_CHANNELS / 4];
 
-    HexNut()
+    float voiceDrift = 0;
+
+    // read heads per voice, the read cursor and readHeads - 1 extra heads,
+    // each with its own vector and mode, see ReadHeads::set
+    int readHeads = 1;
+    int headQuarters[MAX_READ_HEADS];
+    int headModes[MAX_READ_HEADS];
+
+    // params and expander CV are read every controlDivider samples
+    dsp::ClockDivider controlDivider;
+
+    // written by a HexExCV on our right, see HexExCV::Message
+    HexExCV::Message expanderMessages[2];
+
+    HexNut(int maxVoices = PORT_MAX_CHANNELS, HexFactory hexFactory = createHex) : hexFactory(hexFactory), maxVoices(maxVoices)
     {
-        hex = getHex();
+        engines.assign(maxVoices, HexEngine(nullptr));
+        voiceHexes.reserve(maxVoices);
+        addVoices(1);
+        hex = engines[0].hex;
+        displayHex.store(hex);
+        maxChunkBytes = hex->chunkBytes(); // float samples, the largest
+        maxChunks = maxVoices * hex->chunkCount();
+
+        getRightExpander().producerMessage = &expanderMessages[0];
+        getRightExpander().consumerMessage = &expanderMessages[1];
 
         config(PARAMS_LEN, INPUTS_LEN, OUTPUTS_LEN, LIGHTS_LEN);
 
@@ -72,6 +204,334 @@ struct HexNut : Module
 
         configInput(INPUT_INPUT, "Signal");
         configOutput(OUTPUT_OUTPUT, "Signal");
+        configOutput(HEADS_OUTPUT, "Read heads of the first voice");
+
+        controlDivider.setDivision(DEFAULT_CONTROL_DIVISION);
+
+        for (int h = 0; h < MAX_READ_HEADS; h++)
+        {
+            headQuarters[h] = READ_HEAD_QUARTERS[h];
+            headModes[h] = READ_HEAD_FOLLOW;
+        }
+
+        Upkeep::shared().add(this, [this]()
+                             { upkeep(); });
+    }
+
+    ~HexNut()
+    {
+        Upkeep::shared().remove(this);
+    }
+
+    // upkeep thread, what process asked for. The grain pool is shared, a
+    // full one costs each module a few loads.
+    void upkeep()
+    {
+        if (!added.load(std::memory_order_acquire))
+            return;
+        stageRecall();
+        freeRetiredHexes();
+        convertStorage();
+        buildVoices();
+        GrainPool::shared().topUp();
+    }
+
+    // makes hexes for voices up to count, while the audio thread isn't running
+    void addVoices(int count)
+    {
+        for (int v = voiceHexes.size(); v < count; v++)
+        {
+            voiceHexes.push_back(std::unique_ptr<Hex>(hexFactory((SampleFormat)sampleFormat.load(std::memory_order_relaxed))));
+            engines[v].hex = voiceHexes.back().get();
+        }
+    }
+
+    // new voices' hexes, once voiceBuilder has them, at the start of a control
+    // block so their controls start with them
+    void takeVoices()
+    {
+        size_t first = voiceHexes.size();
+        if (!voiceBuilder.take(voiceHexes, (SampleFormat)sampleFormat.load(std::memory_order_relaxed)))
+            return;
+
+        // their controls start on the next sample
+        for (size_t v = first; v < voiceHexes.size(); v++)
+            engines[v].hex = voiceHexes[v].get();
+    }
+
+    // upkeep thread, hexes for voices that started playing
+    void buildVoices()
+    {
+        voiceBuilder.update(hexFactory, (SampleFormat)sampleFormat.load(std::memory_order_acquire));
+    }
+
+    /*
+        New, empty hexes in format for every voice that plays, for a patch
+        before its buffer loads. The old ones wait in retiredHexes for the
+        display, which takes them before another swap can start.
+    */
+    void rebuildHexes(SampleFormat format)
+    {
+        std::vector<std::unique_ptr<Hex>> hexes;
+        hexes.reserve(maxVoices);
+        for (int v = 0; v < channels; v++)
+            hexes.push_back(std::unique_ptr<Hex>(hexFactory(format)));
+        replaceHexes(hexes, format);
+    }
+
+    // hexes for the first voices, the rest wait for voiceBuilder. They come
+    // with room for maxVoices, so the audio thread never allocates here.
+    void replaceHexes(std::vector<std::unique_ptr<Hex>> &hexes, SampleFormat format)
+    {
+        retiredHexes.swap(voiceHexes);
+        voiceHexes.swap(hexes);
+        sampleFormat.store(format, std::memory_order_release);
+
+        engines.assign(maxVoices, HexEngine(nullptr));
+        for (size_t v = 0; v < voiceHexes.size(); v++)
+            engines[v].hex = voiceHexes[v].get();
+        hex = engines[0].hex;
+
+        displayHex.store(hex);
+        hexesRetired.store(true, std::memory_order_release);
+        snapshotSlots.store(0, std::memory_order_relaxed); // snapshots leave with their hexes
+        recallDiscarded = true;
+        controlDivider.reset();
+    }
+
+    /*
+        Every voice's hex at once, between samples, see Hex::captureSnapshot.
+        A recall that copies is staged by upkeep instead. False while one is,
+        as the slots must stay as they are until it is swapped in.
+    */
+    bool processSnapshot(int request)
+    {
+        if (recallState.load(std::memory_order_relaxed) != RECALL_IDLE)
+            return false;
+
+        int action = request / SNAPSHOT_SLOTS, s = request % SNAPSHOT_SLOTS;
+        if (action == RECALL_SNAPSHOT && voiceHexes[0]->recallCopies())
+        {
+            recallCount = 0;
+            for (std::unique_ptr<Hex> &voiceHex : voiceHexes)
+            {
+                if (voiceHex->prepareRecall(s))
+                    recallHexes[recallCount++] = voiceHex.get();
+            }
+            recallDiscarded = false;
+            recallState.store(RECALL_STAGING, std::memory_order_release);
+            return true;
+        }
+
+        for (std::unique_ptr<Hex> &voiceHex : voiceHexes)
+        {
+            if (action == CAPTURE_SNAPSHOT)
+                voiceHex->captureSnapshot(s);
+            else if (action == RECALL_SNAPSHOT)
+                voiceHex->recallSnapshot(s);
+            else
+                voiceHex->clearSnapshot(s);
+        }
+
+        if (action == CAPTURE_SNAPSHOT)
+            snapshotSlots.fetch_or(1 << s, std::memory_order_relaxed);
+        else if (action == CLEAR_SNAPSHOT)
+            snapshotSlots.fetch_and(~(1 << s), std::memory_order_relaxed);
+        return true;
+    }
+
+    // upkeep thread, the recalled buffers, off the audio thread
+    void stageRecall()
+    {
+        if (recallState.load(std::memory_order_acquire) != RECALL_STAGING)
+            return;
+        for (int v = 0; v < recallCount; v++)
+            recallHexes[v]->stageRecall();
+        recallState.store(RECALL_STAGED, std::memory_order_release);
+    }
+
+    // a staged recall, at the start of a control block
+    void publishRecall()
+    {
+        if (recallState.load(std::memory_order_acquire) != RECALL_STAGED)
+            return;
+        if (!recallDiscarded)
+        {
+            for (int v = 0; v < recallCount; v++)
+                recallHexes[v]->publishRecall();
+        }
+        recallState.store(RECALL_IDLE, std::memory_order_relaxed);
+    }
+
+    // slots a voice dropped for want of memory, see Hex::keepChunk, go from
+    // every voice, so a recall never brings back some voices and not others
+    void dropFailedSnapshots()
+    {
+        uint8_t dropped = 0;
+        for (std::unique_ptr<Hex> &voiceHex : voiceHexes)
+        {
+            dropped |= voiceHex->snapshotsDropped;
+            voiceHex->snapshotsDropped = 0;
+        }
+        if (!dropped)
+            return;
+
+        // at once, even with a recall staged, which leaves a dropped slot as it is, see Hex::publishRecall
+        for (int s = 0; s < SNAPSHOT_SLOTS; s++)
+        {
+            if (!(dropped & (1 << s)))
+                continue;
+            for (std::unique_ptr<Hex> &voiceHex : voiceHexes)
+                voiceHex->clearSnapshot(s);
+        }
+        snapshotSlots.fetch_and(~dropped, std::memory_order_relaxed);
+    }
+
+    // a capture or recall from the expander, into the slot its CV picks
+    void processSnapshotTriggers(const HexExCV::Message *message)
+    {
+        bool capture = captureTrigger.process(message->snapshot[HexExCV::SNAPSHOT_CAPTURE], 0.1f, 1.f);
+        bool recall = recallTrigger.process(message->snapshot[HexExCV::SNAPSHOT_RECALL], 0.1f, 1.f);
+        if (!capture && !recall)
+            return;
+
+        int s = clamp((int)message->snapshot[HexExCV::SNAPSHOT_SLOT], 0, SNAPSHOT_SLOTS - 1);
+        snapshotRequest.store((capture ? CAPTURE_SNAPSHOT : RECALL_SNAPSHOT) * SNAPSHOT_SLOTS + s, std::memory_order_relaxed);
+    }
+
+    // upkeep thread, once the store is free, the buffer into new hexes in the storage chosen from the menu
+    void convertStorage()
+    {
+        int format = nextSampleFormat.load();
+        if (format != sampleFormat.load(std::memory_order_acquire))
+            store.convert((SampleFormat)format, maxChunkBytes, maxVoices, hexFactory);
+    }
+
+    // upkeep thread, so the next import or transform can swap in
+    void freeRetiredHexes()
+    {
+        if (!hexesRetired.load(std::memory_order_acquire) || recallState.load(std::memory_order_acquire) == RECALL_STAGING)
+            return;
+        Hex *drawn = drawnHex.load();
+        if (drawn && drawn != displayHex.load())
+            return;
+        retiredHexes.clear();
+        hexesRetired.store(false, std::memory_order_release);
+    }
+
+    // UI thread, the hex to draw, which upkeep keeps until the display moves
+    // on. Checked again once published, in case a swap came in between.
+    Hex *drawHex()
+    {
+        Hex *hex;
+        do
+        {
+            hex = displayHex.load();
+            drawnHex.store(hex);
+        } while (hex != displayHex.load());
+        return hex;
+    }
+
+    // the patch's buffers, into hexes of the format and voices that saved
+    // them. Upkeep converts them to the storage chosen once they are in.
+    void onAdd(const AddEvent &e) override
+    {
+        std::string path = system::join(getPatchStorageDirectory(), BUFFER_FILE);
+        StoreLayout layout;
+        bool saved = BufferStore::readLayout(path, layout);
+
+        SampleFormat format = saved ? (SampleFormat)layout.format : (SampleFormat)nextSampleFormat.load();
+        if (format != sampleFormat)
+            rebuildHexes(format);
+
+        if (saved && store.load(path, layout))
+            addVoices(std::min((int)layout.voices, maxVoices));
+        added.store(true, std::memory_order_release);
+    }
+
+    // autosaves too, only chunks written since the last save go to disk.
+    // This waits for the audio thread to copy them out, and the worker writes
+    // them after. Rack archives the patch storage once this returns, so a
+    // patch file holds the buffer as the last save to finish left it.
+    void onSave(const SaveEvent &e) override
+    {
+        if (store.save(system::join(createPatchStorageDirectory(), BUFFER_FILE), maxChunkBytes, maxChunks))
+            store.waitCopied(STORE_COPY_WAIT_MS);
+    }
+
+    // UI thread, a voice per channel of the file, in the storage chosen from the menu
+    bool importWav(const std::string &path)
+    {
+        return store.importWav(path, APP->engine->getSampleRate(), maxVoices, hexFactory, (SampleFormat)nextSampleFormat.load());
+    }
+
+    // UI thread, a channel per voice
+    bool exportWav(const std::string &path)
+    {
+        return store.exportWav(path, APP->engine->getSampleRate(), maxChunkBytes);
+    }
+
+    // UI thread, every voice's buffer at once, off the audio thread
+    bool transformBuffer(BufferTransform transform)
+    {
+        return store.transform(transform, maxChunkBytes, maxVoices, hexFactory);
+    }
+
+    void setControlDivision(int division)
+    {
+        controlDivider.setDivision(division);
+        controlDivider.reset();
+    }
+
+    json_t *dataToJson() override
+    {
+        json_t *rootJ = json_object();
+        json_object_set_new(rootJ, "controlDivision", json_integer(controlDivider.getDivision()));
+        json_object_set_new(rootJ, "voiceDrift", json_real(voiceDrift));
+        json_object_set_new(rootJ, "readHeads", json_integer(readHeads));
+
+        json_t *headsJ = json_array();
+        for (int h = 0; h < MAX_READ_HEADS - 1; h++)
+        {
+            json_t *headJ = json_object();
+            json_object_set_new(headJ, "quarters", json_integer(headQuarters[h]));
+            json_object_set_new(headJ, "mode", json_integer(headModes[h]));
+            json_array_append_new(headsJ, headJ);
+        }
+        json_object_set_new(rootJ, "heads", headsJ);
+        json_object_set_new(rootJ, "sampleFormat", json_integer(nextSampleFormat.load()));
+        return rootJ;
+    }
+
+    void dataFromJson(json_t *rootJ) override
+    {
+        json_t *controlDivisionJ = json_object_get(rootJ, "controlDivision");
+        if (controlDivisionJ)
+        {
+            int division = json_integer_value(controlDivisionJ);
+            if (std::find(CONTROL_DIVISIONS.begin(), CONTROL_DIVISIONS.end(), division) != CONTROL_DIVISIONS.end())
+                setControlDivision(division);
+        }
+
+        json_t *voiceDriftJ = json_object_get(rootJ, "voiceDrift");
+        if (voiceDriftJ)
+            voiceDrift = json_number_value(voiceDriftJ);
+
+        json_t *readHeadsJ = json_object_get(rootJ, "readHeads");
+        if (readHeadsJ)
+            readHeads = clamp((int)json_integer_value(readHeadsJ), 1, MAX_READ_HEADS);
+
+        json_t *headsJ = json_object_get(rootJ, "heads");
+        for (int h = 0; h < MAX_READ_HEADS - 1 && h < (int)json_array_size(headsJ); h++)
+        {
+            json_t *headJ = json_array_get(headsJ, h);
+            headQuarters[h] = clamp((int)json_integer_value(json_object_get(headJ, "quarters")), -8, 8);
+            headModes[h] = clamp((int)json_integer_value(json_object_get(headJ, "mode")), READ_HEAD_FOLLOW, (int)Hex::VORTEX);
+        }
+
+        json_t *sampleFormatJ = json_object_get(rootJ, "sampleFormat");
+        if (sampleFormatJ)
+            nextSampleFormat = clamp((int)json_integer_value(sampleFormatJ), 0, SAMPLE_FORMATS_LEN - 1);
     }
 
     /* ==================================================================== */
@@ -79,23 +539,158 @@ struct HexNut : Module
 
     void process(const ProcessArgs &args) override
     {
-        // modes
+        if (store.importReady() && !hexesRetired.load(std::memory_order_acquire))
+        {
+            replaceHexes(store.imported, store.importedFormat);
+            store.importTaken();
+        }
+
+        // a transform's shadow hexes leave with the buffers they traded for
+        if (store.transformReady() && !hexesRetired.load(std::memory_order_acquire))
+        {
+            if (store.importedFormat == sampleFormat.load(std::memory_order_relaxed))
+            {
+                for (size_t v = 0; v < std::min(store.imported.size(), voiceHexes.size()); v++)
+                    voiceHexes[v]->swapBuffer(*store.imported[v]);
+            }
+            retiredHexes.swap(store.imported);
+            hexesRetired.store(true, std::memory_order_release);
+            store.importTaken();
+        }
+
+        // menu requests and triggers wait out a staged recall
+        int request = snapshotRequest.load(std::memory_order_relaxed);
+        if (request >= 0 && processSnapshot(request))
+            snapshotRequest.compare_exchange_strong(request, -1);
 
-        float w_mode_v = params[WRITE_MODE_PARAM].getValue();
-        float r_mode_v = params[READ_MODE_PARAM].getValue();
-        hex->writeMode = hex->floatToMode(w_mode_v);
-        hex->readMode = hex->floatToMode(r_mode_v);
+        const HexExCV::Message *message = expanderMessage();
+        if (message)
+            processSnapshotTriggers(message);
 
-        // crop
+        store.process(voiceHexes, (SampleFormat)sampleFormat.load(std::memory_order_relaxed));
 
-        float crop_v = params[CROP_PARAM].getValue();
-        if (crop_v != lastCrop)
+        int inputChannels = clamp(inputs[INPUT_INPUT].getChannels(), 1, maxVoices);
+        if (inputChannels != channels)
         {
-            hex->setCrop(crop_v);
-            lastCrop = crop_v;
+            // start new voices from the current controls, once they have a hex
+            channels = inputChannels;
+            controlDivider.reset();
         }
+        voiceBuilder.want(channels, voiceHexes.size());
 
-        // expander
+        if (controlDivider.getClock() == 0)
+        {
+            publishRecall();
+            dropFailedSnapshots();
+            takeVoices();
+            updateControls(message);
+        }
+        controlDivider.process();
+
+        processVoices();
+    }
+
+    // saves and loads carry on while bypassed
+    void processBypass(const ProcessArgs &args) override
+    {
+        store.process(voiceHexes, (SampleFormat)sampleFormat.load(std::memory_order_relaxed));
+        Module::processBypass(args);
+    }
+
+    virtual void processVoices()
+    {
+        for (int c = 0; c < channels; c += 4)
+        {
+            simd::float_4 in_v = inputs[INPUT_INPUT].getVoltageSimd<simd::float_4>(c);
+            outputs[OUTPUT_OUTPUT].setVoltageSimd(processVoiceGroup(c, in_v), c);
+        }
+        outputs[OUTPUT_OUTPUT].setChannels(channels);
+        outputs[HEADS_OUTPUT].setChannels(engines[0].heads.count + 1);
+    }
+
+    /*
+        Voices c to c + 3. Ramps and i/o run on all four at once, the engines
+        one voice at a time. The first voice's heads go to HEADS_OUTPUT.
+    */
+    simd::float_4 processVoiceGroup(int c, simd::float_4 in)
+    {
+        VoiceRamp &ramp = voiceRamps[c / 4];
+        ramp.process();
+
+        int lanes = std::min(channels - c, 4);
+        simd::float_4 out = 0.f;
+
+        for (int i = 0; i < lanes; i++)
+        {
+            HexEngine &engine = engines[c + i];
+            if (!engine.hex)
+                continue; // silent until its hex is built
+
+            float smoothed[HexEngine::SMOOTHED_LEN];
+            for (int k = 0; k < HexEngine::SMOOTHED_LEN; k++)
+                smoothed[k] = ramp.values[k][i];
+
+            float headsOut[MAX_READ_HEADS + 1];
+            out[i] = engine.step(in[i], smoothed, headsOut);
+
+            if (c + i == 0)
+            {
+                for (int h = 0; h <= engine.heads.count; h++)
+                    outputs[HEADS_OUTPUT].setVoltage(headsOut[h], h);
+            }
+        }
+
+        return out;
+    }
+
+    // the HexExCV or HexExSnap on our right's latest, or nullptr if there is none
+    const HexExCV::Message *expanderMessage()
+    {
+        Module *expander = getRightExpander().module;
+        if (expander && (expander->model == modelHexExCV || expander->model == modelHexExSnap))
+            return (const HexExCV::Message *)getRightExpander().consumerMessage;
+        return nullptr;
+    }
+
+    void updateControls(const HexExCV::Message *message)
+    {
+        for (int v = 0; v < channels; v++)
+            setVoiceControls(v, getControls(v, message));
+
+        for (int c = 0; c < channels; c += 4)
+            voiceRamps[c / 4].start(controlDivider.getDivision());
+    }
+
+    // structural controls apply now, vectors and blend go to the voice's ramp lane
+    virtual void setVoiceControls(int voice, const HexControls &c)
+    {
+        HexEngine &engine = engines[voice];
+        if (!engine.hex)
+            return;
+
+        engine.applyControls(c);
+        engine.setHeads(readHeads - 1);
+        for (int h = 0; h < readHeads - 1; h++)
+            engine.heads.set(h, headQuarters[h], headModes[h]);
+        engine.readDrift = HexEngine::voiceDrift(voice, voiceDrift);
+
+        float targets[HexEngine::SMOOTHED_LEN];
+        engine.setTargets(targets, c);
+        for (int i = 0; i < HexEngine::SMOOTHED_LEN; i++)
+            voiceRamps[voice / 4].targets[i][voice % 4] = targets[i];
+    }
+
+    HexControls getControls(int voice, const HexExCV::Message *message)
+    {
+        HexControls c;
+
+        c.writeMode = params[WRITE_MODE_PARAM].getValue();
+        c.readMode = params[READ_MODE_PARAM].getValue();
+        c.crop = params[CROP_PARAM].getValue();
+        c.readRing = params[READ_RING_PARAM].getValue();
+        c.grainSize = params[GRAIN_SIZE_PARAM].getValue();
+
+        // expander, mono CV is shared by all voices
 
         float cv_vwx_v = 0, cv_vwy_v = 0, cv_vwz_v = 0;
         float cv_vrx_v = 0, cv_vry_v = 0, cv_vrz_v = 0;
@@ -103,85 +698,137 @@ struct HexNut : Module
         float cv_blend_v = 0;
         float cv_scale = 0.1;
 
-        Module *expander = getRightExpander().module;
-        if (expander && expander->model == modelHexExCV)
+        if (message)
         {
-            cv_vwx_v = expander->getInput(HexExCV::CV_VWX_INPUT).getVoltage() * cv_scale;
-            cv_vwy_v = expander->getInput(HexExCV::CV_VWY_INPUT).getVoltage() * cv_scale;
-            cv_vwz_v = expander->getInput(HexExCV::CV_VWZ_INPUT).getVoltage() * cv_scale;
+            cv_vwx_v = message->getVoltage(HexExCV::CV_VWX_INPUT, voice) * cv_scale;
+            cv_vwy_v = message->getVoltage(HexExCV::CV_VWY_INPUT, voice) * cv_scale;
+            cv_vwz_v = message->getVoltage(HexExCV::CV_VWZ_INPUT, voice) * cv_scale;
 
-            cv_write_size_v = expander->getInput(HexExCV::CV_WRITE_SIZE_INPUT).getVoltage() * cv_scale;
+            cv_write_size_v = message->getVoltage(HexExCV::CV_WRITE_SIZE_INPUT, voice) * cv_scale;
 
-            cv_vrx_v = expander->getInput(HexExCV::CV_VRX_INPUT).getVoltage() * cv_scale;
-            cv_vry_v = expander->getInput(HexExCV::CV_VRY_INPUT).getVoltage() * cv_scale;
-            cv_vrz_v = expander->getInput(HexExCV::CV_VRZ_INPUT).getVoltage() * cv_scale;
+            cv_vrx_v = message->getVoltage(HexExCV::CV_VRX_INPUT, voice) * cv_scale;
+            cv_vry_v = message->getVoltage(HexExCV::CV_VRY_INPUT, voice) * cv_scale;
+            cv_vrz_v = message->getVoltage(HexExCV::CV_VRZ_INPUT, voice) * cv_scale;
 
-            cv_read_size_v = expander->getInput(HexExCV::CV_READ_SIZE_INPUT).getVoltage() * cv_scale;
+            cv_read_size_v = message->getVoltage(HexExCV::CV_READ_SIZE_INPUT, voice) * cv_scale;
 
-            cv_blend_v = expander->getInput(HexExCV::CV_BLEND_INPUT).getVoltage() * cv_scale;
+            cv_blend_v = message->getVoltage(HexExCV::CV_BLEND_INPUT, voice) * cv_scale;
         }
 
         // rings
 
-        float w_r_v = params[WRITE_RADIUS_PARAM].getValue() + cv_write_size_v;
-        float r_r_v = params[READ_RADIUS_PARAM].getValue() + cv_read_size_v;
-        hex->setWriteMaxRadius(w_r_v);
-        hex->setReadMaxRadius(r_r_v);
-
-        float read_ring_radius_v = params[READ_RING_PARAM].getValue();
-        if (read_ring_radius_v != lastReadRingRadius)
-        {
-            hex->ringRadius = round(read_ring_radius_v);
-            hex->updateReadRingOffsets();
-            lastReadRingRadius = read_ring_radius_v;
-        }
-
-        // i/o
+        c.writeRadius = params[WRITE_RADIUS_PARAM].getValue() + cv_write_size_v;
+        c.readRadius = params[READ_RADIUS_PARAM].getValue() + cv_read_size_v;
 
-        float in_v = inputs[INPUT_INPUT].getVoltage();
-        float blend_v = params[BLEND_PARAM].getValue() + cv_blend_v;
-        hex->setVoltage(in_v, blend_v);
+        // blend
 
-        outputs[OUTPUT_OUTPUT].setVoltage(hex->getVoltage());
+        c.blend = params[BLEND_PARAM].getValue() + cv_blend_v;
 
         // cursors
 
-        float wx = params[VWX_PARAM].getValue() + cv_vwx_v;
-        float wy = params[VWY_PARAM].getValue() + cv_vwy_v;
-        float wz = params[VWZ_PARAM].getValue() + cv_vwz_v;
+        c.writeX = params[VWX_PARAM].getValue() + cv_vwx_v;
+        c.writeY = params[VWY_PARAM].getValue() + cv_vwy_v;
+        c.writeZ = params[VWZ_PARAM].getValue() + cv_vwz_v;
 
-        hex->advanceWriteCursor(wx, wy, wz);
+        c.readX = params[VRX_PARAM].getValue() + cv_vrx_v;
+        c.readY = params[VRY_PARAM].getValue() + cv_vry_v;
+        c.readZ = params[VRZ_PARAM].getValue() + cv_vrz_v;
 
-        float rx = params[VRX_PARAM].getValue() + cv_vrx_v;
-        float ry = params[VRY_PARAM].getValue() + cv_vry_v;
-        float rz = params[VRZ_PARAM].getValue() + cv_vrz_v;
-
-        hex->advanceReadCursor(rx, ry, rz);
+        return c;
     }
 
     /* ==================================================================== */
     /* ==================================================================== */
 };
 
+// tile brightness by |v|, in steps well under one colour level
+#define LEVEL_LUT_SIZE 8192
+#define LEVEL_LUT_VOLTS 5.f
+
+// drawnColors entry that no tile color matches
+#define NO_COLOR 0xFFFFFFFF
+
+// tiles narrower than this many pixels are drawn from a TilePyramid
+#define TILE_MIN_PIXELS 2.f
+
+// seconds for read and write marks to fade by half
+#define ACTIVITY_HALF_LIFE .04
+
 struct HexDisplay : LedDisplay
 {
     HexNut *module;
     Hex *hex;
     ModuleWidget *moduleWidget;
 
+    // the grid is kept in fb, and only cells whose color changed are drawn again
+    NVGLUframebuffer *fb = nullptr;
+    float fbScale = 0;
+    std::vector<uint32_t> drawnColors;
+    int drawnLevel = -1; // pyramid level in fb, -1 for single tiles
+
+    // marks taken from hex->activityOut, only touched on this thread
+    std::vector<TileActivity> activity;
+    TilePyramid pyramid;
+    std::vector<int> ringOffsets;
+    int ringOffsetsRadius = -1;
+    double activityTime = -1;
+    float tileDecay = 1; // for tiles drawn this frame
+
     HexDisplay()
     {
     }
 
+    ~HexDisplay()
+    {
+        if (fb)
+            nvgluDeleteFramebuffer(fb);
+    }
+
+    void onContextDestroy(const ContextDestroyEvent &e) override
+    {
+        if (fb)
+        {
+            nvgluDeleteFramebuffer(fb);
+            fb = nullptr;
+        }
+        LedDisplay::onContextDestroy(e);
+    }
+
+    void step() override
+    {
+        if (module)
+            hex = module->drawHex();
+        LedDisplay::step();
+    }
+
+    // corners of a hexagon of radius 1, x then y
+    static const float *unitHexagon()
+    {
+        static float vertices[12];
+        static bool ready = false;
+        if (!ready)
+        {
+            for (int i = 0; i < 6; i++)
+            {
+                float angle = i * M_PI / 3;
+                vertices[i * 2] = cos(angle);
+                vertices[i * 2 + 1] = sin(angle);
+            }
+            ready = true;
+        }
+        return vertices;
+    }
+
     void hexagon(NVGcontext *vg, float x, float y, float size, NVGcolor color)
     {
+        const float *vertices = unitHexagon();
+
         nvgBeginPath(vg);
         nvgMoveTo(vg, x + size, y);
 
         for (int i = 1; i < 6; i++)
         {
-            float angle = i * M_PI / 3;
-            nvgLineTo(vg, x + cos(angle) * size, y + sin(angle) * size);
+            nvgLineTo(vg, x + vertices[i * 2] * size, y + vertices[i * 2 + 1] * size);
         }
 
         nvgClosePath(vg);
@@ -189,62 +836,283 @@ struct HexDisplay : LedDisplay
         nvgFill(vg);
     }
 
-    NVGcolor colorFromTile(Tile tile)
+    // brightness by |v| on a log scale, so bins are linear in |v|
+    static const uint8_t *levels()
+    {
+        static uint8_t lut[LEVEL_LUT_SIZE];
+        static bool ready = false;
+        if (!ready)
+        {
+            for (int i = 0; i < LEVEL_LUT_SIZE; i++)
+            {
+                float vNorm = (i + .5f) / LEVEL_LUT_SIZE;
+                float vDB = 1.0 + std::log10(vNorm) * .5; // DB is (* 20) but this give us more brightness
+                lut[i] = 255 * clamp(vDB, 0.0, 1.0);
+            }
+            ready = true;
+        }
+        return lut;
+    }
+
+    // color for a peak |v| and its marks, packed as 0x00RRGGBB
+    static uint32_t packColor(float v, float writ, float read)
     {
-        float vNorm = std::fabs(tile.v) / 5.0;
-        float vDB = 1.0 + std::log10(vNorm) * .5; // DB is (* 20) but this give us more brightness
-        vDB = clamp(vDB, 0.0, 1.0);
+        int level = std::fabs(v) * (LEVEL_LUT_SIZE / LEVEL_LUT_VOLTS);
+        int vColor = levels()[std::min(level, LEVEL_LUT_SIZE - 1)];
 
-        float vColor = 255 * vDB;
-        int r = fmin(255, round(vColor + 255 * tile.writ));
+        int r = fmin(255, round(vColor + 255 * writ));
         int g = vColor;
-        int b = fmin(255, round(vColor + 255 * tile.read));
-        return nvgRGBA(r, g, b, 255);
+        int b = fmin(255, round(vColor + 255 * read));
+        return r << 16 | g << 8 | b;
+    }
+
+    static NVGcolor unpackColor(uint32_t color)
+    {
+        return nvgRGBA(color >> 16, (color >> 8) & 0xFF, color & 0xFF, 255);
+    }
+
+    uint32_t tileColor(int i)
+    {
+        const TileActivity &tile = activity[i];
+        return packColor(hex->voltages[i], tile.writ, tile.read);
+    }
+
+    NVGcolor colorFromTile(int i)
+    {
+        return unpackColor(tileColor(i));
     }
 
-    void center(const DrawArgs &args)
+    void center(NVGcontext *vg)
     {
-        nvgTranslate(args.vg, 150, 4);
-        nvgRotate(args.vg, 3 * M_PI / 6);
+        nvgTranslate(vg, 150, 4);
+        nvgRotate(vg, 3 * M_PI / 6);
     }
 
-    void drawTile(const DrawArgs &args, Tile tile)
+    void drawTile(NVGcontext *vg, int i)
     {
-        hexagon(args.vg, tile.x, tile.y, hex->size, colorFromTile(tile));
+        const TilePosition &position = hex->positions[i];
+        hexagon(vg, position.x, position.y, hex->size, colorFromTile(i));
+    }
+
+    /*
+        Pyramid level to draw at this scale, or -1 for single tiles. Tiles are
+        drawn while they're a couple of pixels across, and groups from the
+        first level whose cells are at least a pixel.
+    */
+    int levelForScale(float scale)
+    {
+        if (hex->dy * scale >= TILE_MIN_PIXELS)
+            return -1;
+
+        const PyramidLayout *layout = hex->pyramidLayout;
+        int level = 0;
+        while (level + 1 < layout->levels && layout->cellSizes[level] * scale < 1)
+            level++;
+        return level;
+    }
+
+    /*
+        Draws the tiles, or the groups at level, whose color is not the one in
+        drawnColors, or all of them with no drawnColors.
+    */
+    void drawCells(NVGcontext *vg, int level, uint32_t *drawnColors)
+    {
+        if (level < 0)
+        {
+            for (int i = 0; i < hex->length; i++)
+            {
+                uint32_t color = tileColor(i);
+                if (!drawnColors || color != drawnColors[i])
+                {
+                    const TilePosition &position = hex->positions[i];
+                    hexagon(vg, position.x, position.y, hex->size, unpackColor(color));
+                    if (drawnColors)
+                        drawnColors[i] = color;
+                }
+                activity[i].writ *= tileDecay;
+                activity[i].read *= tileDecay;
+            }
+            return;
+        }
+
+        const PyramidLayout *layout = hex->pyramidLayout;
+        const std::vector<TileGroup> &groups = pyramid.groups[level];
+        const std::vector<TilePosition> &corners = layout->corners[level];
+        float cellSize = layout->cellSizes[level];
+
+        for (size_t g = 0; g < groups.size(); g++)
+        {
+            const TileGroup &group = groups[g];
+            uint32_t color = packColor(group.peak, group.writ, group.read);
+            if (!drawnColors || color != drawnColors[g])
+            {
+                nvgBeginPath(vg);
+                nvgRect(vg, corners[g].x, corners[g].y, cellSize, cellSize);
+                nvgFillColor(vg, unpackColor(color));
+                nvgFill(vg);
+                if (drawnColors)
+                    drawnColors[g] = color;
+            }
+        }
+    }
+
+    void markWrite(int i)
+    {
+        activity[i].writ = 1;
+        pyramid.write(i, hex->voltages[i]);
+    }
+
+    void markRead(int i)
+    {
+        activity[i].read = 1;
+        pyramid.read(i);
+    }
+
+    // the same taps as Hex::updateReadRingOffsets
+    void updateRingOffsets(int radius)
+    {
+        ringOffsets.clear();
+        int top = hex->z_step * radius;
+
+        for (int dir : hex->ringDirs)
+        {
+            for (int i = 0; i < radius; i++)
+            {
+                top = top + dir;
+                ringOffsets.push_back(top);
+            }
+        }
+        ringOffsetsRadius = radius;
+    }
+
+    /*
+        Fades marks by the time since the last frame, then lights up the tiles
+        in the newest frame from the audio thread, if there is one. Groups are
+        only refreshed while they are drawn.
+    */
+    void updateActivity(int level)
+    {
+        if (activity.size() != (size_t)hex->length)
+        {
+            activity.assign(hex->length, TileActivity{0, 0});
+            pyramid.init(hex->pyramidLayout);
+        }
+
+        double now = system::getTime();
+        tileDecay = activityTime < 0 ? 1 : std::pow(.5, (now - activityTime) / ACTIVITY_HALF_LIFE);
+        activityTime = now;
+
+        if (level >= 0)
+            pyramid.refresh(hex->voltages.data(), tileDecay);
+
+        const ActivityFrame *frame = hex->activityOut.take();
+        if (!frame)
+            return;
+
+        for (int n = 0; n < frame->writes.count; n++)
+            markWrite(frame->writes.tiles[n]);
+
+        for (int n = 0; n < frame->reads.count; n++)
+            markRead(frame->reads.tiles[n]);
+
+        if (frame->ringReads.count > 0 && frame->ringRadius != ringOffsetsRadius)
+            updateRingOffsets(frame->ringRadius);
+
+        for (int n = 0; n < frame->ringReads.count; n++)
+        {
+            int cursor = frame->ringReads.tiles[n];
+            markRead(cursor);
+            for (int offset : ringOffsets)
+                markRead(hex->wrap(cursor + offset, frame->readLength));
+        }
+    }
+
+    // draws changed cells into fb, or all of them when fb or the level is new
+    void updateFramebuffer(const DrawArgs &args)
+    {
+        float scale = getAbsoluteZoom() * APP->window->pixelRatio;
+        int width = std::ceil(box.size.x * scale);
+        int height = std::ceil(box.size.y * scale);
+
+        if (!fb || scale != fbScale)
+        {
+            if (fb)
+                nvgluDeleteFramebuffer(fb);
+            fb = nvgluCreateFramebuffer(args.vg, width, height, 0);
+            fbScale = scale;
+            drawnColors.clear();
+            if (!fb)
+                return;
+        }
+
+        int level = levelForScale(scale);
+        updateActivity(level);
+
+        nvgluBindFramebuffer(fb);
+        glViewport(0, 0, width, height);
+
+        if (level != drawnLevel || drawnColors.empty())
+        {
+            glClearColor(0, 0, 0, 0);
+            glClear(GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+            drawnColors.assign(level < 0 ? hex->length : pyramid.groups[level].size(), NO_COLOR);
+            drawnLevel = level;
+        }
+
+        NVGcontext *vg = APP->window->fbVg;
+        nvgBeginFrame(vg, box.size.x, box.size.y, scale);
+        center(vg);
+        drawCells(vg, level, drawnColors.data());
+        nvgEndFrame(vg);
+        nvgluBindFramebuffer(NULL);
     }
 
     void drawTiles(const DrawArgs &args)
     {
-        for (int i = 0; i < hex->length; i++)
+        updateFramebuffer(args);
+
+        if (fb)
         {
-            Tile tile = hex->tiles[i];
-            drawTile(args, tile);
-            hex->decayTile(i);
+            NVGpaint paint = nvgImagePattern(args.vg, 0, 0, box.size.x, box.size.y, 0, fb->image, 1.0);
+            nvgBeginPath(args.vg);
+            nvgRect(args.vg, 0, 0, box.size.x, box.size.y);
+            nvgFillPaint(args.vg, paint);
+            nvgFill(args.vg);
+            return;
         }
+
+        // no framebuffer to be had, draw every cell
+        int level = levelForScale(getAbsoluteZoom() * APP->window->pixelRatio);
+        updateActivity(level);
+
+        nvgSave(args.vg);
+        center(args.vg);
+        drawCells(args.vg, level, nullptr);
+        nvgRestore(args.vg);
     }
 
     void drawWriteCursor(const DrawArgs &args)
     {
         int writeCursor = hex->writeCursor;
-        Tile tile = hex->tiles[writeCursor];
-        hexagon(args.vg, tile.x, tile.y, hex->size * 2, nvgRGBA(255, 0, 0, 255));
-        drawTile(args, tile);
+        const TilePosition &position = hex->positions[writeCursor];
+        hexagon(args.vg, position.x, position.y, hex->size * 2, nvgRGBA(255, 0, 0, 255));
+        drawTile(args.vg, writeCursor);
     }
 
     void drawReadCursor(const DrawArgs &args)
     {
         int readCursor = hex->readCursor;
-        Tile tile = hex->tiles[readCursor];
-        hexagon(args.vg, tile.x, tile.y, hex->size * 2, nvgRGBA(0, 0, 255, 255));
-        drawTile(args, tile);
+        const TilePosition &position = hex->positions[readCursor];
+        hexagon(args.vg, position.x, position.y, hex->size * 2, nvgRGBA(0, 0, 255, 255));
+        drawTile(args.vg, readCursor);
     }
 
     void drawLayer(const DrawArgs &args, int layer) override
     {
         if (module && layer == 1)
         {
-            center(args);
             drawTiles(args);
+            center(args.vg);
             drawWriteCursor(args);
             drawReadCursor(args);
         }
@@ -282,39 +1150,241 @@ struct HexNutWidget : ModuleWidget
 
         addInput(createInputCentered<FlatPort>(Vec(7 + tR, 346 + tR), module, HexNut::INPUT_INPUT));
         addOutput(createOutputCentered<FlatPortOut>(Vec(119 + tR, 346 + tR), module, HexNut::OUTPUT_OUTPUT));
+        addOutput(createOutputCentered<FlatPortOut>(Vec(63 + tR, 346 + tR), module, HexNut::HEADS_OUTPUT));
 
         if (module != nullptr && module->hex != nullptr)
         {
             HexDisplay *display = createWidget<HexDisplay>((Vec(0.0, 41 - 4)));
             display->box.size = (Vec(150, 130 + 8));
             display->module = module;
-            display->hex = module->hex;
+            display->hex = module->drawHex();
             display->moduleWidget = this;
             addChild(display);
         }
     }
+
+    void appendContextMenu(Menu *menu) override
+    {
+        HexNut *module = dynamic_cast<HexNut *>(this->module);
+        if (!module)
+            return;
+
+        std::vector<std::string> labels;
+        for (int division : CONTROL_DIVISIONS)
+            labels.push_back(division == 1 ? "Every sample" : string::f("Every %d samples", division));
+
+        menu->addChild(new MenuSeparator);
+        menu->addChild(createIndexSubmenuItem(
+            "Control rate", labels,
+            [=]()
+            {
+                auto it = std::find(CONTROL_DIVISIONS.begin(), CONTROL_DIVISIONS.end(), (int)module->controlDivider.getDivision());
+                return it - CONTROL_DIVISIONS.begin();
+            },
+            [=](size_t i)
+            { module->setControlDivision(CONTROL_DIVISIONS[i]); }));
+
+        if (module->maxVoices > 1)
+        {
+            menu->addChild(createIndexSubmenuItem(
+                "Voice drift", VOICE_DRIFT_LABELS,
+                [=]()
+                {
+                    auto it = std::find(VOICE_DRIFTS.begin(), VOICE_DRIFTS.end(), module->voiceDrift);
+                    return it == VOICE_DRIFTS.end() ? 0 : it - VOICE_DRIFTS.begin();
+                },
+                [=](size_t i)
+                { module->voiceDrift = VOICE_DRIFTS[i]; }));
+
+            std::vector<std::string> headLabels;
+            for (int heads : READ_HEAD_COUNTS)
+                headLabels.push_back(std::to_string(heads));
+
+            menu->addChild(createIndexSubmenuItem(
+                "Read heads", headLabels,
+                [=]()
+                {
+                    auto it = std::find(READ_HEAD_COUNTS.begin(), READ_HEAD_COUNTS.end(), module->readHeads);
+                    return it == READ_HEAD_COUNTS.end() ? 0 : it - READ_HEAD_COUNTS.begin();
+                },
+                [=](size_t i)
+                { module->readHeads = READ_HEAD_COUNTS[i]; }));
+
+            // the read cursor is head 1, on the first channel of HEADS
+            menu->addChild(createSubmenuItem(
+                "Extra heads", "",
+                [=](Menu *menu)
+                {
+                    for (int h = 0; h < MAX_READ_HEADS - 1; h++)
+                    {
+                        menu->addChild(createSubmenuItem(
+                            string::f("Head %d", h + 2), h + 1 < module->readHeads ? "" : "Off",
+                            [=](Menu *menu)
+                            {
+                                menu->addChild(createIndexSubmenuItem(
+                                    "Speed", READ_HEAD_SPEED_LABELS,
+                                    [=]()
+                                    {
+                                        auto it = std::find(READ_HEAD_SPEEDS.begin(), READ_HEAD_SPEEDS.end(), module->headQuarters[h]);
+                                        return it == READ_HEAD_SPEEDS.end() ? 0 : it - READ_HEAD_SPEEDS.begin();
+                                    },
+                                    [=](size_t i)
+                                    { module->headQuarters[h] = READ_HEAD_SPEEDS[i]; }));
+                                menu->addChild(createIndexSubmenuItem(
+                                    "Mode", READ_HEAD_MODE_LABELS,
+                                    [=]()
+                                    { return module->headModes[h] - READ_HEAD_FOLLOW; },
+                                    [=](size_t i)
+                                    { module->headModes[h] = (int)i + READ_HEAD_FOLLOW; }));
+                            }));
+                    }
+                }));
+        }
+
+        menu->addChild(createIndexSubmenuItem(
+            "Sample storage", SAMPLE_FORMAT_LABELS,
+            [=]()
+            { return module->nextSampleFormat.load(); },
+            [=](size_t i)
+            { module->nextSampleFormat = i; }));
+
+        menu->addChild(createSubmenuItem(
+            "Snapshots", "",
+            [=](Menu *menu)
+            {
+                for (int s = 0; s < SNAPSHOT_SLOTS; s++)
+                {
+                    bool captured = module->snapshotSlots.load() & 1 << s;
+                    menu->addChild(createSubmenuItem(
+                        string::f("Slot %d", s + 1), captured ? "Captured" : "",
+                        [=](Menu *menu)
+                        {
+                            menu->addChild(createMenuItem("Capture", "", [=]()
+                                                          { module->snapshotRequest = CAPTURE_SNAPSHOT * SNAPSHOT_SLOTS + s; }));
+                            menu->addChild(createMenuItem(
+                                "Recall", "", [=]()
+                                { module->snapshotRequest = RECALL_SNAPSHOT * SNAPSHOT_SLOTS + s; },
+                                !captured));
+                            menu->addChild(createMenuItem(
+                                "Clear", "", [=]()
+                                { module->snapshotRequest = CLEAR_SNAPSHOT * SNAPSHOT_SLOTS + s; },
+                                !captured));
+                        }));
+                }
+            }));
+
+        bool busy = module->store.state.load() != BufferStore::IDLE;
+        menu->addChild(createSubmenuItem(
+            "Transform buffer", "",
+            [=](Menu *menu)
+            {
+                for (int i = 0; i < BUFFER_TRANSFORMS_LEN; i++)
+                {
+                    menu->addChild(createMenuItem(
+                        BUFFER_TRANSFORM_LABELS[i], "",
+                        [=]()
+                        { module->transformBuffer((BufferTransform)i); },
+                        busy));
+                }
+            }));
+        menu->addChild(createMenuItem(
+            "Load WAV into buffer…", "",
+            [=]()
+            {
+                std::string path;
+                if (chooseWav(OSDIALOG_OPEN, path))
+                    module->importWav(path);
+            },
+            busy));
+        menu->addChild(createMenuItem(
+            "Save buffer as WAV…", "",
+            [=]()
+            {
+                std::string path;
+                if (chooseWav(OSDIALOG_SAVE, path))
+                    module->exportWav(path);
+            },
+            busy));
+    }
+
+    static bool chooseWav(osdialog_file_action action, std::string &path)
+    {
+        osdialog_filters *filters = osdialog_filters_parse(WAV_FILTERS);
+        char *chosen = osdialog_file(action, nullptr, action == OSDIALOG_SAVE ? "buffer.wav" : nullptr, filters);
+        osdialog_filters_free(filters);
+        if (!chosen)
+            return false;
+
+        path = chosen;
+        std::free(chosen);
+        if (action == OSDIALOG_SAVE && string::lowercase(system::getExtension(path)) != ".wav")
+            path += ".wav";
+        return true;
+    }
 };
 
 Model *modelHexNut = createModel<HexNut, HexNutWidget>("HexNut");
 
 struct HexaGrain : HexNut
 {
-    GrainHex _hex = GrainHex(16);
-    GrainHex *getHex() override { return &_hex; }
-
-    HexaGrain()
+    static Hex *createGrainHex(SampleFormat format)
     {
-        hex = getHex();
+        return createStoredGrainHex(HEXAGRAIN_RADIUS, format);
+    }
+
+    // the read cursor passes over grains quieter than this, see GrainHex::skipBelow
+    float skipBelow = 0;
+
+    // what the display shows of each grain, see GrainHex::setDisplay
+    int grainDisplay = GRAIN_LEVEL;
 
+    // mono, a grain hex per voice would cost more memory than it's worth
+    HexaGrain() : HexNut(1, createGrainHex)
+    {
         configParam(GRAIN_SIZE_PARAM, 0.f, 1.f, 1.f, "Write Grain Size");
     }
 
-    void process(const ProcessArgs &args) override
+    GrainHex *grainHex()
+    {
+        return static_cast<GrainHex *>(hex);
+    }
+
+    json_t *dataToJson() override
+    {
+        json_t *rootJ = HexNut::dataToJson();
+        json_object_set_new(rootJ, "skipBelow", json_real(skipBelow));
+        json_object_set_new(rootJ, "grainDisplay", json_integer(grainDisplay));
+        return rootJ;
+    }
+
+    void dataFromJson(json_t *rootJ) override
+    {
+        HexNut::dataFromJson(rootJ);
+
+        json_t *skipBelowJ = json_object_get(rootJ, "skipBelow");
+        if (skipBelowJ)
+            skipBelow = json_number_value(skipBelowJ);
+
+        json_t *grainDisplayJ = json_object_get(rootJ, "grainDisplay");
+        if (grainDisplayJ)
+            grainDisplay = clamp((int)json_integer_value(grainDisplayJ), 0, GRAIN_DISPLAYS_LEN - 1);
+    }
+
+    // grains advance their own cursors, so run the scalar engine
+    void processVoices() override
     {
-        HexNut::process(args);
+        float out_v = engines[0].process(inputs[INPUT_INPUT].getVoltage());
+        outputs[OUTPUT_OUTPUT].setVoltage(out_v);
+        outputs[OUTPUT_OUTPUT].setChannels(1);
+        outputs[HEADS_OUTPUT].setVoltage(out_v);
+        outputs[HEADS_OUTPUT].setChannels(1);
+    }
 
-        float grain_size_v = params[GRAIN_SIZE_PARAM].getValue();
-        hex->setSize(grain_size_v);
+    void setVoiceControls(int voice, const HexControls &c) override
+    {
+        engines[voice].setControls(c, controlDivider.getDivision());
+        grainHex()->skipBelow = skipBelow;
+        grainHex()->setDisplay((GrainDisplay)grainDisplay);
     }
 };
 
@@ -326,6 +1396,32 @@ struct HexaGrainWidget : HexNutWidget
 
         addParam(createParam<FlatKnob>(Vec(7, 206), module, HexNut::GRAIN_SIZE_PARAM));
     }
+
+    void appendContextMenu(Menu *menu) override
+    {
+        HexNutWidget::appendContextMenu(menu);
+
+        HexaGrain *module = dynamic_cast<HexaGrain *>(this->module);
+        if (!module)
+            return;
+
+        menu->addChild(createIndexSubmenuItem(
+            "Skip quiet grains", GRAIN_SKIP_LABELS,
+            [=]()
+            {
+                auto it = std::find(GRAIN_SKIP_LEVELS.begin(), GRAIN_SKIP_LEVELS.end(), module->skipBelow);
+                return it == GRAIN_SKIP_LEVELS.end() ? 0 : it - GRAIN_SKIP_LEVELS.begin();
+            },
+            [=](size_t i)
+            { module->skipBelow = GRAIN_SKIP_LEVELS[i]; }));
+
+        menu->addChild(createIndexSubmenuItem(
+            "Grain display", GRAIN_DISPLAY_LABELS,
+            [=]()
+            { return module->grainDisplay; },
+            [=](size_t i)
+            { module->grainDisplay = i; }));
+    }
 };
 
 Model *modelHexaGrain = createModel<HexaGrain, HexaGrainWidget>("HexaGrain");
\ No newline at end of file
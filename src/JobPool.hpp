@@ -0,0 +1,99 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// most threads the pool starts, however many cores there are
+#define JOB_POOL_MAX_THREADS 4
+
+/*
+    Worker threads shared by every module, for whole-buffer work that must
+    stay off the audio thread: saving, loading, WAV files and transforms, see
+    BufferStore. Threads start with the first job, half as many as there are
+    cores but at least two, as saves and loads spend most of theirs waiting.
+
+    Only the UI thread and the workers take the queue's lock, the audio thread
+    hears from a job through the atomics of whoever queued it. Each job has an
+    owner, so a module going away can take back the jobs it queued before
+    they start, rather than wait behind other modules' jobs.
+*/
+
+struct JobPool
+{
+    struct Job
+    {
+        const void *owner;
+        std::function<void()> run;
+    };
+
+    std::vector<std::thread> threads;
+    std::deque<Job> jobs;
+    std::mutex mutex;
+    std::condition_variable queued;
+    bool stopping = false;
+
+    static JobPool &shared()
+    {
+        static JobPool pool;
+        return pool;
+    }
+
+    ~JobPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        queued.notify_all();
+        for (std::thread &thread : threads)
+            thread.join();
+    }
+
+    void run(const void *owner, std::function<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (threads.empty())
+            {
+                int count = std::min(std::max((int)std::thread::hardware_concurrency() / 2, 2), JOB_POOL_MAX_THREADS);
+                for (int i = 0; i < count; i++)
+                    threads.emplace_back(&JobPool::work, this);
+            }
+            jobs.push_back(Job{owner, std::move(job)});
+        }
+        queued.notify_one();
+    }
+
+    // jobs of owner that hadn't started, which now never will
+    int cancel(const void *owner)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto waiting = std::remove_if(jobs.begin(), jobs.end(), [=](const Job &job)
+                                      { return job.owner == owner; });
+        int count = jobs.end() - waiting;
+        jobs.erase(waiting, jobs.end());
+        return count;
+    }
+
+    void work()
+    {
+        while (true)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                queued.wait(lock, [this]()
+                            { return stopping || !jobs.empty(); });
+                if (jobs.empty())
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job.run();
+        }
+    }
+};
@@ -0,0 +1,115 @@
+#pragma once
+#include "Hex.hpp"
+
+#define MAX_READ_HEADS 8
+
+// default vector of each extra head as a multiple of the read vector, in quarters
+static const int READ_HEAD_QUARTERS[MAX_READ_HEADS] = {-4, 2, -2, 8, -8, 6, -6, 1};
+
+// a head's mode that is whatever the hex's read mode is, else a Hex::Mode
+#define READ_HEAD_FOLLOW -1
+
+/*
+    Extra read cursors on one Hex's buffer. Each moves at its own multiple of
+    the read vector, in quarters from -2 to 2 times it, and walks its own
+    ring or vortex in its own mode, or the hex's read mode, see set. State is
+    kept as arrays across heads, so the vector math for every head runs as
+    one loop the compiler can vectorize, and tiles are gathered in a second
+    pass.
+*/
+
+struct ReadHeads
+{
+    int count = 0;
+
+    int quarters[MAX_READ_HEADS];
+    int modes[MAX_READ_HEADS];
+
+    int64_t x[MAX_READ_HEADS] = {};
+    int64_t y[MAX_READ_HEADS] = {};
+    int64_t z[MAX_READ_HEADS] = {};
+    int vectorCursors[MAX_READ_HEADS] = {};
+    int cursors[MAX_READ_HEADS] = {};
+
+    RingWalk walks[MAX_READ_HEADS];
+
+    ReadHeads()
+    {
+        for (int i = 0; i < MAX_READ_HEADS; i++)
+            set(i, READ_HEAD_QUARTERS[i], READ_HEAD_FOLLOW);
+    }
+
+    // head i's vector in quarters of the read vector, at most 8 either way so
+    // a step stays under a lap, and its mode or READ_HEAD_FOLLOW
+    void set(int i, int q, int mode)
+    {
+        quarters[i] = std::max(-8, std::min(q, 8));
+        modes[i] = std::max(READ_HEAD_FOLLOW, std::min(mode, (int)Hex::VORTEX));
+    }
+
+    // heads start out on hex's read cursor and drift off from there
+    void setCount(int n, const Hex &hex)
+    {
+        for (int i = count; i < n; i++)
+        {
+            x[i] = hex.readPhase.x;
+            y[i] = hex.readPhase.y;
+            z[i] = hex.readPhase.z;
+            cursors[i] = hex.readCursor;
+            walks[i] = hex.readWalk;
+        }
+        count = n;
+    }
+
+    void advance(Hex &hex, float vx, float vy, float vz)
+    {
+        int64_t stepX = hex.toPhaseStep(vx);
+        int64_t stepY = hex.toPhaseStep(vy);
+        int64_t stepZ = hex.toPhaseStep(vz);
+
+        int64_t length = hex.phaseLength;
+        int y_step = hex.y_step;
+        int z_step = hex.z_step;
+
+        // all heads, so the trip count is fixed. As in Hex::moveVector, steps
+        // stay under a lap, even at twice the read vector.
+        for (int i = 0; i < MAX_READ_HEADS; i++)
+        {
+            int64_t hx = x[i] + stepX * quarters[i] / 4;
+            int64_t hy = y[i] + stepY * quarters[i] / 4;
+            int64_t hz = z[i] + stepZ * quarters[i] / 4;
+
+            hx = hx >= length ? hx - length : (hx < 0 ? hx + length : hx);
+            hy = hy >= length ? hy - length : (hy < 0 ? hy + length : hy);
+            hz = hz >= length ? hz - length : (hz < 0 ? hz + length : hz);
+
+            x[i] = hx;
+            y[i] = hy;
+            z[i] = hz;
+
+            vectorCursors[i] = hex.phaseToTile(hx) + hex.phaseToTile(hy) * y_step + hex.phaseToTile(hz) * z_step;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            Hex::Mode mode = modes[i] == READ_HEAD_FOLLOW ? hex.readMode : (Hex::Mode)modes[i];
+            if (mode != Hex::VECTOR)
+                hex.stepRing(mode, walks[i], hex.readMaxRadius, hex.readLength);
+
+            cursors[i] = hex.wrap(vectorCursors[i] + walks[i].cursor, hex.readLength);
+        }
+    }
+
+    // one tile per head into out, returns their sum
+    float read(Hex &hex, float *out)
+    {
+        float sum = 0;
+        for (int i = 0; i < count; i++)
+        {
+            hex.markRead(cursors[i]);
+            out[i] = hex.voltages[cursors[i]];
+            sum += out[i];
+        }
+        return sum;
+    }
+};
@@ -0,0 +1,168 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+// volts at full scale of a 16-bit fixed point sample, louder ones clip
+#define FIXED16_VOLTS 10.f
+
+// how a buffer keeps its samples, in the order the context menu lists them
+enum SampleFormat
+{
+    FLOAT_SAMPLES,
+    FIXED16_SAMPLES,
+    HALF_SAMPLES,
+    SAMPLE_FORMATS_LEN
+};
+
+/*
+    Sample storage types, each a Sample type and its conversions to and from
+    float. Buffers are templated on these, so every read and write converts
+    inline and the float one converts to nothing. load and store convert a run
+    of samples in loops the compiler can vectorize.
+*/
+
+struct FloatSamples
+{
+    typedef float Sample;
+    static const SampleFormat format = FLOAT_SAMPLES;
+
+    static float toFloat(float s)
+    {
+        return s;
+    }
+
+    static float fromFloat(float v)
+    {
+        return v;
+    }
+
+    static void load(const float *s, float *v, int count)
+    {
+        std::copy(s, s + count, v);
+    }
+
+    static void store(const float *v, float *s, int count)
+    {
+        std::copy(v, v + count, s);
+    }
+};
+
+struct Fixed16Samples
+{
+    typedef int16_t Sample;
+    static const SampleFormat format = FIXED16_SAMPLES;
+
+    static float toFloat(int16_t s)
+    {
+        return s * (FIXED16_VOLTS / 32767.f);
+    }
+
+    // nearest step, halves away from zero
+    static int16_t fromFloat(float v)
+    {
+        float steps = std::min(std::max(v, -FIXED16_VOLTS), FIXED16_VOLTS) * (32767.f / FIXED16_VOLTS);
+        return int16_t(int32_t(steps + (steps < 0 ? -.5f : .5f)));
+    }
+
+    static void load(const int16_t *s, float *v, int count)
+    {
+        for (int i = 0; i < count; i++)
+            v[i] = toFloat(s[i]);
+    }
+
+    static void store(const float *v, int16_t *s, int count)
+    {
+        for (int i = 0; i < count; i++)
+            s[i] = fromFloat(v[i]);
+    }
+};
+
+/*
+    IEEE half floats, converted in integer steps without branches so a run
+    of them vectorizes on any x86 Rack builds for, and with F16C where the
+    build allows it. Both round to nearest even and give the same bits.
+*/
+
+struct HalfSamples
+{
+    typedef uint16_t Sample;
+    static const SampleFormat format = HALF_SAMPLES;
+
+    static uint32_t bitsOf(float v)
+    {
+        uint32_t x;
+        std::memcpy(&x, &v, sizeof(x));
+        return x;
+    }
+
+    static float floatOf(uint32_t x)
+    {
+        float v;
+        std::memcpy(&v, &x, sizeof(v));
+        return v;
+    }
+
+    static float toFloat(uint16_t s)
+    {
+#ifdef __F16C__
+        return _cvtsh_ss(s);
+#else
+        uint32_t x = uint32_t(s & 0x7fff) << 13;
+        uint32_t exponent = x & 0x0f800000;
+        x += (127 - 15) << 23;
+        // infinities and NaNs keep the top exponent
+        x += exponent == 0x0f800000 ? (128 - 16) << 23 : 0;
+        // denormals are normalized by the FPU
+        float denormal = floatOf(x + (1 << 23)) - floatOf(113 << 23);
+        x = exponent == 0 ? bitsOf(denormal) : x;
+        return floatOf(x | uint32_t(s & 0x8000) << 16);
+#endif
+    }
+
+    static uint16_t fromFloat(float v)
+    {
+#ifdef __F16C__
+        return _cvtss_sh(v, _MM_FROUND_TO_NEAREST_INT);
+#else
+        uint32_t x = bitsOf(v);
+        uint32_t sign = (x >> 16) & 0x8000;
+        x &= 0x7fffffff;
+        // rebias the exponent, rounding the dropped mantissa to even
+        uint32_t normal = (x + 0xc8000fff + ((x >> 13) & 1)) >> 13;
+        // under the smallest normal half, the FPU rounds into the denormals
+        uint32_t denormal = bitsOf(floatOf(x) + .5f) - 0x3f000000;
+        uint32_t h = x < 0x38800000 ? denormal : normal;
+        // too large for a half, or already infinite or NaN
+        h = x >= 0x47800000 ? (x > 0x7f800000 ? 0x7e00 : 0x7c00) : h;
+        return uint16_t(h | sign);
+#endif
+    }
+
+    static void load(const uint16_t *s, float *v, int count)
+    {
+        int i = 0;
+#ifdef __F16C__
+        for (; i + 8 <= count; i += 8)
+            _mm256_storeu_ps(v + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(s + i))));
+#endif
+        for (; i < count; i++)
+            v[i] = toFloat(s[i]);
+    }
+
+    static void store(const float *v, uint16_t *s, int count)
+    {
+        int i = 0;
+#ifdef __F16C__
+        for (; i + 8 <= count; i += 8)
+            _mm_storeu_si128((__m128i *)(s + i), _mm256_cvtps_ph(_mm256_loadu_ps(v + i), _MM_FROUND_TO_NEAREST_INT));
+#endif
+        for (; i < count; i++)
+            s[i] = fromFloat(v[i]);
+    }
+};
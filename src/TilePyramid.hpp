@@ -0,0 +1,227 @@
+#pragma once
+#include <cmath>
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+
+// levels of groups above the tiles, enough to cover any radius up to 255
+#define PYRAMID_MAX_LEVELS 10
+
+// the display refreshes peaks from the tiles over this many frames
+#define PYRAMID_REFRESH_FRAMES 8
+
+// where a tile is drawn
+struct TilePosition
+{
+    float x;
+    float y;
+};
+
+// recent writes and reads as the display shows them, see ActivityChannel
+struct TileActivity
+{
+    float writ;
+    float read;
+};
+
+// what the display draws for a group of tiles
+struct TileGroup
+{
+    float peak; // largest |v| in the group, refreshed by the display
+    float writ;
+    float read;
+};
+
+/*
+    Tiles grouped into square cells, with each level's cells twice as wide as
+    the one below, up to a few cells covering the whole hex. Groups at each
+    level are numbered in the order they are first met, and only depend on the
+    radius, so one layout is shared by every hex of that radius.
+*/
+
+struct PyramidLayout
+{
+    int levels = 0;
+    float cellSizes[PYRAMID_MAX_LEVELS];
+
+    std::vector<int> tileGroups; // group of each tile at level 0
+
+    // per level, the corner each group is drawn from and its group a level up
+    std::vector<TilePosition> corners[PYRAMID_MAX_LEVELS];
+    std::vector<int> parents[PYRAMID_MAX_LEVELS];
+
+    // tiles of each level 0 group, from tileStarts[g] to tileStarts[g + 1]
+    std::vector<int> tileStarts;
+    std::vector<int> tiles;
+
+    void build(const TilePosition *positions, int length, float cellSize, float extent)
+    {
+        levels = 0;
+        while (levels < PYRAMID_MAX_LEVELS && (levels == 0 || cellSize < extent / 2))
+        {
+            cellSizes[levels++] = cellSize;
+            cellSize *= 2;
+        }
+
+        // cells of each group at the current level
+        std::vector<std::pair<int, int>> cells;
+        std::map<std::pair<int, int>, int> groups;
+
+        tileGroups.resize(length);
+        for (int i = 0; i < length; i++)
+        {
+            std::pair<int, int> cell(std::floor(positions[i].x / cellSizes[0]), std::floor(positions[i].y / cellSizes[0]));
+            auto found = groups.insert(std::make_pair(cell, int(cells.size())));
+            if (found.second)
+                cells.push_back(cell);
+            tileGroups[i] = found.first->second;
+        }
+
+        for (int level = 0; level < levels; level++)
+        {
+            corners[level].resize(cells.size());
+            for (size_t g = 0; g < cells.size(); g++)
+            {
+                corners[level][g].x = cells[g].first * cellSizes[level];
+                corners[level][g].y = cells[g].second * cellSizes[level];
+            }
+
+            if (level + 1 == levels)
+                break;
+
+            // the top level has no parents, the rest halve their cells
+            std::vector<std::pair<int, int>> parentCells;
+            groups.clear();
+            parents[level].resize(cells.size());
+            for (size_t g = 0; g < cells.size(); g++)
+            {
+                std::pair<int, int> cell(cells[g].first >> 1, cells[g].second >> 1);
+                auto found = groups.insert(std::make_pair(cell, int(parentCells.size())));
+                if (found.second)
+                    parentCells.push_back(cell);
+                parents[level][g] = found.first->second;
+            }
+            cells.swap(parentCells);
+        }
+
+        // counting sort of tiles by their level 0 group
+        tileStarts.assign(corners[0].size() + 1, 0);
+        for (int g : tileGroups)
+            tileStarts[g + 1]++;
+        for (size_t g = 1; g < tileStarts.size(); g++)
+            tileStarts[g] += tileStarts[g - 1];
+
+        tiles.resize(length);
+        std::vector<int> next(tileStarts.begin(), tileStarts.end() - 1);
+        for (int i = 0; i < length; i++)
+            tiles[next[tileGroups[i]]++] = i;
+    }
+
+    int groupCount(int level) const
+    {
+        return corners[level].size();
+    }
+};
+
+/*
+    Peak |v| and activity for each group of a hex's tiles, so the display can
+    draw a level whose cells are about a pixel wide instead of every tile.
+
+    Marks only ever raise groups, and stop climbing at the first level already
+    marked, since every group is at least as high as the groups under it.
+    Peaks can't be lowered from there, so they are refreshed from the tiles a
+    slice at a time, and activity decays as it does per tile.
+*/
+
+struct TilePyramid
+{
+    const PyramidLayout *layout = nullptr;
+    std::vector<TileGroup> groups[PYRAMID_MAX_LEVELS];
+    int refreshFrame = 0;
+
+    void init(const PyramidLayout *l)
+    {
+        layout = l;
+        for (int level = 0; level < layout->levels; level++)
+            groups[level].assign(layout->groupCount(level), TileGroup{0, 0, 0});
+    }
+
+    void write(int i, float v)
+    {
+        float peak = std::fabs(v);
+        int g = layout->tileGroups[i];
+        for (int level = 0; level < layout->levels; level++)
+        {
+            TileGroup &group = groups[level][g];
+            if (group.writ == 1 && group.peak >= peak)
+                return;
+
+            group.writ = 1;
+            group.peak = std::max(group.peak, peak);
+
+            if (level + 1 < layout->levels)
+                g = layout->parents[level][g];
+        }
+    }
+
+    void read(int i)
+    {
+        int g = layout->tileGroups[i];
+        for (int level = 0; level < layout->levels; level++)
+        {
+            TileGroup &group = groups[level][g];
+            if (group.read == 1)
+                return;
+
+            group.read = 1;
+
+            if (level + 1 < layout->levels)
+                g = layout->parents[level][g];
+        }
+    }
+
+    // once per display frame, see above
+    void refresh(const float *voltages, float decay)
+    {
+        const std::vector<TileGroup> &bottom = groups[0];
+        int count = bottom.size();
+        int slice = (count + PYRAMID_REFRESH_FRAMES - 1) / PYRAMID_REFRESH_FRAMES;
+        int first = refreshFrame * slice;
+        int last = std::min(count, first + slice);
+        refreshFrame = (refreshFrame + 1) % PYRAMID_REFRESH_FRAMES;
+
+        for (int g = first; g < last; g++)
+        {
+            float peak = 0;
+            for (int t = layout->tileStarts[g]; t < layout->tileStarts[g + 1]; t++)
+                peak = std::max(peak, std::fabs(voltages[layout->tiles[t]]));
+            groups[0][g].peak = peak;
+        }
+
+        for (int level = 0; level < layout->levels; level++)
+        {
+            for (TileGroup &group : groups[level])
+            {
+                group.writ *= decay;
+                group.read *= decay;
+            }
+        }
+
+        // coarser levels are small, so they are folded again in full
+        for (int level = 1; level < layout->levels; level++)
+        {
+            std::vector<TileGroup> &upper = groups[level];
+            for (TileGroup &group : upper)
+                group.peak = 0;
+
+            const std::vector<int> &parents = layout->parents[level - 1];
+            const std::vector<TileGroup> &lower = groups[level - 1];
+            for (size_t g = 0; g < lower.size(); g++)
+            {
+                TileGroup &parent = upper[parents[g]];
+                parent.peak = std::max(parent.peak, lower[g].peak);
+            }
+        }
+    }
+};
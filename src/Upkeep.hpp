@@ -0,0 +1,82 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// how often the upkeep thread looks in on its tasks
+#define UPKEEP_INTERVAL_MS 2
+
+/*
+    A thread shared by every module, for the housekeeping the audio thread
+    asks for but mustn't do itself, like making hexes for voices that started
+    playing. The audio thread only sets atomics, which each task looks at
+    every UPKEEP_INTERVAL_MS and acts on, passing anything slow to the
+    JobPool. Nothing waits on the UI, so a module works the same with its
+    panel scrolled away, or with no window at all.
+
+    Each task has an owner, which removes it before going away. Removing
+    waits for a pass that is running, so a task never outlives its owner.
+*/
+
+struct Upkeep
+{
+    struct Task
+    {
+        const void *owner;
+        std::function<void()> run;
+    };
+
+    std::thread thread;
+    std::vector<Task> tasks;
+    std::mutex mutex;
+    std::condition_variable stopped;
+    bool stopping = false;
+
+    static Upkeep &shared()
+    {
+        static Upkeep upkeep;
+        return upkeep;
+    }
+
+    ~Upkeep()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        stopped.notify_all();
+        if (thread.joinable())
+            thread.join();
+    }
+
+    void add(const void *owner, std::function<void()> task)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!thread.joinable())
+            thread = std::thread(&Upkeep::work, this);
+        tasks.push_back(Task{owner, std::move(task)});
+    }
+
+    void remove(const void *owner)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.erase(std::remove_if(tasks.begin(), tasks.end(), [=](const Task &task)
+                                   { return task.owner == owner; }),
+                    tasks.end());
+    }
+
+    void work()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopped.wait_for(lock, std::chrono::milliseconds(UPKEEP_INTERVAL_MS), [this]()
+                                 { return stopping; }))
+        {
+            for (Task &task : tasks)
+                task.run();
+        }
+    }
+};
@@ -0,0 +1,253 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// volts at full scale of a WAV sample, Rack's audio convention
+#define WAV_VOLTS 5.f
+
+// zero crossings of the resampling sinc on each side, and steps between them
+#define WAV_SINC_ZEROS 16
+#define WAV_SINC_PHASES 256
+
+/*
+    Minimal RIFF/WAVE codec. Reads 16, 24 and 32 bit PCM and 32 bit float,
+    including WAVE_FORMAT_EXTENSIBLE, and writes 32 bit float. Samples are
+    interleaved and normalized to [-1, 1].
+*/
+
+struct Wav
+{
+    int channels = 1;
+    int sampleRate = 48000;
+    std::vector<float> samples;
+
+    int frames() const
+    {
+        return channels > 0 ? samples.size() / channels : 0;
+    }
+
+    static uint32_t readU32(const uint8_t *p)
+    {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | (uint32_t(p[3]) << 24);
+    }
+
+    static uint16_t readU16(const uint8_t *p)
+    {
+        return p[0] | (p[1] << 8);
+    }
+
+    bool load(const std::string &path, std::string &error)
+    {
+        FILE *file = fopen(path.c_str(), "rb");
+        if (!file)
+        {
+            error = "cannot open " + path;
+            return false;
+        }
+
+        std::vector<uint8_t> data;
+        uint8_t chunk[65536];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+            data.insert(data.end(), chunk, chunk + n);
+        fclose(file);
+
+        if (data.size() < 12 || memcmp(&data[0], "RIFF", 4) || memcmp(&data[8], "WAVE", 4))
+        {
+            error = path + " is not a WAV file";
+            return false;
+        }
+
+        int format = 0, bits = 0;
+        const uint8_t *pcm = nullptr;
+        size_t pcmBytes = 0;
+
+        for (size_t pos = 12; pos + 8 <= data.size();)
+        {
+            const uint8_t *header = &data[pos];
+            size_t size = readU32(header + 4);
+            size_t body = pos + 8;
+            size = std::min(size, data.size() - body);
+
+            if (!memcmp(header, "fmt ", 4) && size >= 16)
+            {
+                format = readU16(&data[body]);
+                channels = readU16(&data[body + 2]);
+                sampleRate = readU32(&data[body + 4]);
+                bits = readU16(&data[body + 14]);
+
+                // WAVE_FORMAT_EXTENSIBLE keeps the real format in its subformat GUID
+                if (format == 0xFFFE && size >= 26)
+                    format = readU16(&data[body + 24]);
+            }
+            else if (!memcmp(header, "data", 4))
+            {
+                pcm = data.data() + body;
+                pcmBytes = size;
+            }
+
+            pos = body + size + (size & 1);
+        }
+
+        if (!pcm || channels < 1 || bits < 8)
+        {
+            error = path + " has no audio data";
+            return false;
+        }
+
+        size_t count = pcmBytes / (bits / 8);
+        samples.resize(count);
+
+        // an empty data chunk, no frames to read
+        if (count == 0)
+            return true;
+
+        if (format == 3 && bits == 32)
+        {
+            memcpy(samples.data(), pcm, count * 4);
+        }
+        else if (format == 1 && bits == 16)
+        {
+            for (size_t i = 0; i < count; i++)
+                samples[i] = int16_t(readU16(pcm + i * 2)) / 32768.f;
+        }
+        else if (format == 1 && bits == 24)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                const uint8_t *p = pcm + i * 3;
+                int32_t v = (p[0] << 8) | (p[1] << 16) | (uint32_t(p[2]) << 24);
+                samples[i] = v / 2147483648.f;
+            }
+        }
+        else if (format == 1 && bits == 32)
+        {
+            for (size_t i = 0; i < count; i++)
+                samples[i] = int32_t(readU32(pcm + i * 4)) / 2147483648.f;
+        }
+        else
+        {
+            error = path + ": unsupported WAV format " + std::to_string(format) + "/" + std::to_string(bits) + " bit";
+            return false;
+        }
+
+        samples.resize(count - count % channels);
+        return true;
+    }
+
+    /*
+        Converts to rate through a Blackman windowed sinc, low-passed below the
+        lower of the two Nyquists, keeping at most maxFrames. The sinc is
+        tabled at WAV_SINC_PHASES steps between samples.
+    */
+    void resample(int rate, int maxFrames)
+    {
+        int inFrames = frames();
+        double ratio = double(rate) / sampleRate;
+        int outFrames = std::min<double>(maxFrames, std::floor(inFrames * ratio));
+
+        if (rate == sampleRate || rate < 1 || sampleRate < 1 || inFrames < 1)
+        {
+            samples.resize(size_t(std::min(inFrames, maxFrames)) * channels);
+            return;
+        }
+
+        double cutoff = std::min(1.0, ratio);
+        int half = std::ceil(WAV_SINC_ZEROS / cutoff); // input samples either side
+
+        // taps by input distance, in steps of 1 / WAV_SINC_PHASES
+        std::vector<float> table(half * WAV_SINC_PHASES + 1);
+        for (size_t i = 0; i < table.size(); i++)
+        {
+            double d = double(i) / WAV_SINC_PHASES;
+            double x = M_PI * d * cutoff;
+            double sinc = x == 0 ? 1 : std::sin(x) / x;
+            double window = .42 + .5 * std::cos(M_PI * d / half) + .08 * std::cos(2 * M_PI * d / half);
+            table[i] = cutoff * sinc * window;
+        }
+
+        std::vector<float> out(size_t(outFrames) * channels, 0.f);
+        for (int o = 0; o < outFrames; o++)
+        {
+            double t = o / ratio;
+            int center = std::floor(t);
+            int first = std::max(0, center - half + 1);
+            int last = std::min(inFrames - 1, center + half);
+
+            float *frame = &out[size_t(o) * channels];
+            for (int k = first; k <= last; k++)
+            {
+                int step = std::lround(std::fabs(t - k) * WAV_SINC_PHASES);
+                if (step >= (int)table.size())
+                    continue;
+                float tap = table[step];
+                const float *in = &samples[size_t(k) * channels];
+                for (int c = 0; c < channels; c++)
+                    frame[c] += tap * in[c];
+            }
+        }
+
+        samples.swap(out);
+        sampleRate = rate;
+    }
+
+    // channel c of every frame, scaled by gain
+    std::vector<float> channel(int c, float gain) const
+    {
+        std::vector<float> out(frames());
+        for (size_t i = 0; i < out.size(); i++)
+            out[i] = samples[i * channels + c] * gain;
+        return out;
+    }
+
+    static void writeU32(FILE *file, uint32_t v)
+    {
+        uint8_t b[4] = {uint8_t(v), uint8_t(v >> 8), uint8_t(v >> 16), uint8_t(v >> 24)};
+        fwrite(b, 1, 4, file);
+    }
+
+    static void writeU16(FILE *file, uint16_t v)
+    {
+        uint8_t b[2] = {uint8_t(v), uint8_t(v >> 8)};
+        fwrite(b, 1, 2, file);
+    }
+
+    bool save(const std::string &path, std::string &error) const
+    {
+        FILE *file = fopen(path.c_str(), "wb");
+        if (!file)
+        {
+            error = "cannot write " + path;
+            return false;
+        }
+
+        uint32_t dataBytes = samples.size() * 4;
+
+        fwrite("RIFF", 1, 4, file);
+        writeU32(file, 36 + dataBytes);
+        fwrite("WAVE", 1, 4, file);
+
+        fwrite("fmt ", 1, 4, file);
+        writeU32(file, 16);
+        writeU16(file, 3); // IEEE float
+        writeU16(file, channels);
+        writeU32(file, sampleRate);
+        writeU32(file, sampleRate * channels * 4);
+        writeU16(file, channels * 4);
+        writeU16(file, 32);
+
+        fwrite("data", 1, 4, file);
+        writeU32(file, dataBytes);
+        bool ok = samples.empty() || fwrite(samples.data(), 4, samples.size(), file) == samples.size();
+
+        ok = fclose(file) == 0 && ok;
+        if (!ok)
+            error = "short write to " + path;
+        return ok;
+    }
+};
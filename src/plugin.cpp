@@ -1,4 +1,5 @@
 #include "plugin.hpp"
+#include "GrainPool.hpp"
 
 Plugin *pluginInstance;
 
@@ -9,9 +10,13 @@ void init(Plugin *p)
     // Add modules here
     p->addModel(modelHexNut);
     p->addModel(modelHexExCV);
+    p->addModel(modelHexExSnap);
     p->addModel(modelHexaGrain);
     p->addModel(modelRepeat);
 
+    // grains and snapshots take blocks on the audio thread, the modules' upkeep tops the pool up
+    GrainPool::shared().refillOnAllocate = false;
+
     // Any other plugin initialization may go here.
     // As an alternative, consider lazy-loading assets and lookup tables when your module is created to reduce startup times of Rack.
 }
@@ -9,5 +9,6 @@ extern Plugin *pluginInstance;
 // Declare each Model, defined in each module source file
 extern Model *modelHexNut;
 extern Model *modelHexExCV;
+extern Model *modelHexExSnap;
 extern Model *modelHexaGrain;
 extern Model *modelRepeat;
\ No newline at end of file
@@ -0,0 +1,39 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+/*
+    The engine headers only lean on Rack for clamp(). These stand-ins let the
+    tools in this directory build them without the Rack SDK.
+*/
+
+inline float clamp(float x, float a, float b)
+{
+    return std::max(std::min(x, b), a);
+}
+
+inline int clamp(int x, int a, int b)
+{
+    return std::max(std::min(x, b), a);
+}
+
+#include "../src/Hex.hpp"
+#include "../src/GrainHex.hpp"
+
+// names the tools' --storage options take, by SampleFormat
+static const char *STORAGE_NAMES[] = {"float", "fixed", "half"};
+
+inline bool storageNamed(const std::string &name, SampleFormat &format)
+{
+    for (int f = 0; f < SAMPLE_FORMATS_LEN; f++)
+    {
+        if (name == STORAGE_NAMES[f])
+        {
+            format = SampleFormat(f);
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,551 @@
+#include "Headless.hpp"
+#include "Perf.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+
+/*
+    Drives the Hex and GrainHex engines through their per-sample calls
+    (setVoltage, getVoltage, advanceWriteCursor and advanceReadCursor) and
+    reports the cost of every write/read mode pairing across spread radii,
+    crop values and engine radii.
+
+    With --block N the same work goes through processBlock in blocks of N
+    samples instead, which runs the block kernels for the current modes, as
+    hexrender does for blocks without automation. --verify checks that both
+    paths, and the one-sample kernels the modules run, give bit-identical
+    output and buffers for every case, and exits non-zero if they don't.
+
+    Engines ending in -fixed and -half store their samples as 16-bit fixed
+    point and half floats, see SampleStorage.hpp.
+
+    usage: hexbench [--samples N] [--engine hex86,hex16,grain16,...]
+                    [--spread all | r,r,...] [--crop c,c,...] [--block N]
+                    [--verify] [--csv]
+*/
+
+struct Engine
+{
+    const char *name;
+    bool grain;
+    int radius;
+    SampleFormat format;
+};
+
+static const Engine ENGINES[] = {
+    {"hex86", false, 86, FLOAT_SAMPLES},
+    {"hex16", false, 16, FLOAT_SAMPLES},
+    {"grain16", true, 16, FLOAT_SAMPLES},
+    {"hex86-fixed", false, 86, FIXED16_SAMPLES},
+    {"hex86-half", false, 86, HALF_SAMPLES},
+    {"grain16-fixed", true, 16, FIXED16_SAMPLES},
+    {"grain16-half", true, 16, HALF_SAMPLES},
+};
+
+// the hex type an engine runs, plain Hex for float tiles as HexNut makes them
+template <typename Storage>
+struct TileHex
+{
+    typedef StoredHex<Storage> type;
+};
+
+template <>
+struct TileHex<FloatSamples>
+{
+    typedef Hex type;
+};
+
+static const char *MODE_NAMES[] = {"vector", "ring", "vortex"};
+
+// typical HexNut settings: an on-axis write head and an off-axis read head
+static const float WRITE_VECTOR[] = {1.f, 0.f, 0.f};
+static const float READ_VECTOR[] = {.73f, .21f, -.12f};
+static const float BLEND = .8f;
+static const float MAX_RADIUS = .5f;
+static const float GRAIN_SIZE = .1f;
+
+static const int NOISE_LENGTH = 4096;
+static const float BENCH_SAMPLE_RATE = 96000.f;
+
+struct BenchCase
+{
+    const Engine *engine;
+    Hex::Mode writeMode;
+    Hex::Mode readMode;
+    int spread;
+    float crop;
+};
+
+struct BenchResult
+{
+    double nsPerSample;
+    double cacheMisses;
+    double branchMisses;
+    bool counters;
+};
+
+struct Bench
+{
+    long samples = 1 << 16;
+    int block = 0;
+    bool csv = false;
+
+    std::vector<const Engine *> engines;
+    std::vector<int> spreads = {0, 1, 2, 4, 8, 16, 32, 64};
+    std::vector<float> crops = {1.f, .5f, .1f};
+
+    std::vector<float> noise;
+    volatile float sink = 0;
+
+    Bench()
+    {
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<float> dist(-5.f, 5.f);
+        noise.resize(NOISE_LENGTH);
+        for (float &v : noise)
+            v = dist(rng);
+    }
+
+    void prefill(Hex *hex)
+    {
+        for (int i = 0; i < hex->length; i++)
+            hex->voltages[i] = noise[i % NOISE_LENGTH];
+    }
+
+    template <typename Storage>
+    void prefill(StoredGrainHex<Storage> *hex)
+    {
+        prefill(static_cast<Hex *>(hex));
+        for (int i = 0; i < hex->length; i++)
+        {
+            StoredGrain<Storage> &grain = hex->grains[i];
+            grain.reserve();
+            for (int j = 0; j < grain.size; j++)
+                grain.buffer[j] = Storage::fromFloat(noise[(i + j) % NOISE_LENGTH]);
+        }
+    }
+
+    void configure(Hex *hex, const BenchCase &c)
+    {
+        hex->writeMode = c.writeMode;
+        hex->readMode = c.readMode;
+        hex->setWriteMaxRadius(MAX_RADIUS);
+        hex->setReadMaxRadius(MAX_RADIUS);
+        hex->setCrop(c.crop);
+        hex->ringRadius = c.spread;
+        hex->updateReadRingOffsets();
+    }
+
+    CursorParams cursorParams()
+    {
+        CursorParams p;
+        p.writeX = WRITE_VECTOR[0];
+        p.writeY = WRITE_VECTOR[1];
+        p.writeZ = WRITE_VECTOR[2];
+        p.readX = READ_VECTOR[0];
+        p.readY = READ_VECTOR[1];
+        p.readZ = READ_VECTOR[2];
+        p.blend = BLEND;
+        p.grainSize = GRAIN_SIZE;
+        return p;
+    }
+
+    // one sample, in the order HexEngine::process makes the calls
+    float step(Hex *hex, long i)
+    {
+        hex->setVoltage(noise[i & (NOISE_LENGTH - 1)], BLEND);
+        float out = hex->getVoltage();
+        hex->advanceWriteCursor(WRITE_VECTOR[0], WRITE_VECTOR[1], WRITE_VECTOR[2]);
+        hex->advanceReadCursor(READ_VECTOR[0], READ_VECTOR[1], READ_VECTOR[2]);
+        hex->setSize(GRAIN_SIZE);
+        return out;
+    }
+
+    // `count` samples from i on, through the per-sample or the block path
+    float steps(Hex *hex, long i, long count, const CursorParams &p)
+    {
+        float acc = 0;
+
+        if (block < 1)
+        {
+            for (long end = i + count; i < end; i++)
+                acc += step(hex, i);
+            return acc;
+        }
+
+        // block divides NOISE_LENGTH, so no block runs off the end of the noise
+        float out[NOISE_LENGTH];
+        for (long end = i + count; i < end; i += block)
+        {
+            int n = std::min(long(block), end - i);
+            hex->processBlock(&noise[i & (NOISE_LENGTH - 1)], out, n, p);
+            acc += out[n - 1];
+        }
+        return acc;
+    }
+
+    BenchResult measure(Hex *hex, const BenchCase &c)
+    {
+        configure(hex, c);
+        CursorParams p = cursorParams();
+
+        float acc = steps(hex, 0, samples / 8, p);
+
+        PerfCounter cacheMisses(PerfCounter::CACHE_MISSES);
+        PerfCounter branchMisses(PerfCounter::BRANCH_MISSES);
+
+        cacheMisses.start();
+        branchMisses.start();
+        auto start = std::chrono::steady_clock::now();
+
+        acc += steps(hex, 0, samples, p);
+
+        auto end = std::chrono::steady_clock::now();
+        uint64_t cache = cacheMisses.stop();
+        uint64_t branch = branchMisses.stop();
+
+        sink = sink + acc;
+
+        BenchResult result;
+        result.nsPerSample = std::chrono::duration<double, std::nano>(end - start).count() / samples;
+        result.cacheMisses = double(cache) / samples;
+        result.branchMisses = double(branch) / samples;
+        result.counters = cacheMisses.valid() && branchMisses.valid();
+        return result;
+    }
+
+    BenchResult run(const BenchCase &c)
+    {
+        switch (c.engine->format)
+        {
+        case FIXED16_SAMPLES:
+            return runAs<Fixed16Samples>(c);
+        case HALF_SAMPLES:
+            return runAs<HalfSamples>(c);
+        default:
+            return runAs<FloatSamples>(c);
+        }
+    }
+
+    template <typename Storage>
+    BenchResult runAs(const BenchCase &c)
+    {
+        if (c.engine->grain)
+            return runHex<StoredGrainHex<Storage>>(c);
+        return runHex<typename TileHex<Storage>::type>(c);
+    }
+
+    template <typename T>
+    BenchResult runHex(const BenchCase &c)
+    {
+        std::unique_ptr<T> hex(new T(c.engine->radius));
+        prefill(hex.get());
+        return measure(hex.get(), c);
+    }
+
+    bool verify(const BenchCase &c)
+    {
+        switch (c.engine->format)
+        {
+        case FIXED16_SAMPLES:
+            return verifyAs<Fixed16Samples>(c);
+        case HALF_SAMPLES:
+            return verifyAs<HalfSamples>(c);
+        default:
+            return verifyAs<FloatSamples>(c);
+        }
+    }
+
+    template <typename Storage>
+    bool verifyAs(const BenchCase &c)
+    {
+        if (c.engine->grain)
+            return verifyHex<StoredGrainHex<Storage>>(c);
+        return verifyHex<typename TileHex<Storage>::type>(c);
+    }
+
+    /*
+        Runs the case through the per-sample calls, the block kernels and the
+        one-sample kernels HexEngine::step runs, on identically filled engines,
+        with ragged block lengths so blocks start and end everywhere, and
+        compares output and buffer contents bit for bit.
+    */
+    template <typename T>
+    bool verifyHex(const BenchCase &c)
+    {
+        std::unique_ptr<T> a(new T(c.engine->radius));
+        std::unique_ptr<T> b(new T(c.engine->radius));
+        std::unique_ptr<T> k(new T(c.engine->radius));
+        prefill(a.get());
+        prefill(b.get());
+        prefill(k.get());
+        configure(a.get(), c);
+        configure(b.get(), c);
+        configure(k.get(), c);
+
+        CursorParams p = cursorParams();
+        static const int LENGTHS[] = {1, 7, 64, 100, 3, 257};
+
+        std::vector<float> expected(samples), actual(samples);
+        for (long i = 0; i < samples; i++)
+            expected[i] = step(a.get(), i);
+
+        std::vector<float> input(samples);
+        for (long i = 0; i < samples; i++)
+            input[i] = noise[i & (NOISE_LENGTH - 1)];
+
+        for (long i = 0, k = 0; i < samples; k++)
+        {
+            int n = std::min(long(LENGTHS[k % 6]), samples - i);
+            b->processBlock(&input[i], &actual[i], n, p);
+            i += n;
+        }
+
+        std::vector<float> stepped(samples);
+        Hex::SampleKernel kernel = k->sampleKernel();
+        for (long i = 0; i < samples; i++)
+            stepped[i] = (k.get()->*kernel)(input[i], p);
+
+        return !memcmp(expected.data(), actual.data(), samples * sizeof(float)) && sameBuffers(a.get(), b.get()) &&
+               !memcmp(expected.data(), stepped.data(), samples * sizeof(float)) && sameBuffers(a.get(), k.get());
+    }
+
+    bool sameBuffers(Hex *a, Hex *b)
+    {
+        return !memcmp(a->voltages.data(), b->voltages.data(), a->length * sizeof(float)) &&
+               sameMarks(a->activityOut.frame().writes, b->activityOut.frame().writes) &&
+               sameMarks(a->activityOut.frame().reads, b->activityOut.frame().reads) &&
+               sameMarks(a->activityOut.frame().ringReads, b->activityOut.frame().ringReads);
+    }
+
+    bool sameMarks(const ActivityList &a, const ActivityList &b)
+    {
+        return a.count == b.count && !memcmp(a.tiles, b.tiles, a.count * sizeof(int));
+    }
+
+    bool sameAnalysis(const GrainAnalysis &a, const GrainAnalysis &b)
+    {
+        return a.sumAbs == b.sumAbs && a.sumSquares == b.sumSquares && a.peak == b.peak &&
+               a.zeroCrossings == b.zeroCrossings && a.count == b.count && a.negative == b.negative &&
+               !memcmp(&a.last, &b.last, sizeof(GrainStats));
+    }
+
+    template <typename Storage>
+    bool sameBuffers(StoredGrainHex<Storage> *a, StoredGrainHex<Storage> *b)
+    {
+        for (int i = 0; i < a->length; i++)
+        {
+            const StoredGrain<Storage> &ga = a->grains[i], &gb = b->grains[i];
+            if (ga.size != gb.size || ga.writeIndex != gb.writeIndex || ga.readIndex != gb.readIndex ||
+                ga.capacity != gb.capacity || memcmp(ga.buffer, gb.buffer, ga.size * sizeof(typename Storage::Sample)) ||
+                !sameAnalysis(ga.analysis, gb.analysis))
+                return false;
+        }
+        // block runs mark a read once per run, so only the voltages have to match
+        return !memcmp(a->voltages.data(), b->voltages.data(), a->length * sizeof(float));
+    }
+
+    int verifyAll()
+    {
+        int cases = 0, failures = 0;
+
+        for (const Engine *engine : engines)
+            for (int w = Hex::VECTOR; w <= Hex::VORTEX; w++)
+                for (int r = Hex::VECTOR; r <= Hex::VORTEX; r++)
+                    for (int spread : spreads)
+                        for (float crop : crops)
+                        {
+                            BenchCase c = {engine, Hex::Mode(w), Hex::Mode(r), spread, crop};
+                            bool same = verify(c);
+                            cases++;
+
+                            if (!same)
+                            {
+                                failures++;
+                                printf("MISMATCH %s %s/%s spread %d crop %.2f\n", engine->name, MODE_NAMES[w], MODE_NAMES[r], spread, crop);
+                            }
+                        }
+
+        printf("verify: %d of %d cases sample-identical\n", cases - failures, cases);
+        return failures ? 1 : 0;
+    }
+
+    void printHeader()
+    {
+        if (block > 0 && !csv)
+            printf("# processBlock, %d samples per block\n", block);
+
+        if (csv)
+            printf("engine,write,read,spread,crop,ns_per_sample,msamples_per_s,realtime_x,cache_miss_per_sample,branch_miss_per_sample\n");
+        else
+            printf("%-13s %-7s %-7s %6s %5s %10s %11s %10s %11s %11s\n",
+                   "engine", "write", "read", "spread", "crop", "ns/sample", "Msamples/s", "x96k", "cache-miss", "branch-miss");
+    }
+
+    void printResult(const BenchCase &c, const BenchResult &r)
+    {
+        double msps = 1e3 / r.nsPerSample;
+        double realtime = msps * 1e6 / BENCH_SAMPLE_RATE;
+
+        if (csv)
+        {
+            printf("%s,%s,%s,%d,%.2f,%.2f,%.3f,%.1f,", c.engine->name, MODE_NAMES[c.writeMode], MODE_NAMES[c.readMode],
+                   c.spread, c.crop, r.nsPerSample, msps, realtime);
+            if (r.counters)
+                printf("%.3f,%.3f\n", r.cacheMisses, r.branchMisses);
+            else
+                printf(",\n");
+        }
+        else
+        {
+            printf("%-13s %-7s %-7s %6d %5.2f %10.2f %11.3f %10.1f ", c.engine->name, MODE_NAMES[c.writeMode],
+                   MODE_NAMES[c.readMode], c.spread, c.crop, r.nsPerSample, msps, realtime);
+            if (r.counters)
+                printf("%11.3f %11.3f\n", r.cacheMisses, r.branchMisses);
+            else
+                printf("%11s %11s\n", "n/a", "n/a");
+        }
+        fflush(stdout);
+    }
+
+    void runAll()
+    {
+        printHeader();
+
+        for (const Engine *engine : engines)
+        {
+            double total = 0, worst = 0;
+            int count = 0;
+
+            for (int w = Hex::VECTOR; w <= Hex::VORTEX; w++)
+                for (int r = Hex::VECTOR; r <= Hex::VORTEX; r++)
+                    for (int spread : spreads)
+                        for (float crop : crops)
+                        {
+                            BenchCase c = {engine, Hex::Mode(w), Hex::Mode(r), spread, crop};
+                            BenchResult result = run(c);
+                            printResult(c, result);
+
+                            total += result.nsPerSample;
+                            worst = std::max(worst, result.nsPerSample);
+                            count++;
+                        }
+
+            if (!csv)
+                printf("# %s: mean %.2f ns/sample, worst %.2f ns/sample over %d cases\n\n", engine->name, total / count, worst, count);
+        }
+    }
+};
+
+static std::vector<std::string> split(const char *list)
+{
+    std::vector<std::string> items;
+    std::string item;
+    for (const char *p = list; *p; p++)
+    {
+        if (*p == ',')
+        {
+            items.push_back(item);
+            item.clear();
+        }
+        else
+            item += *p;
+    }
+    items.push_back(item);
+    return items;
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: hexbench [--samples N] [--engine hex86,hex16,grain16,...] [--spread all | r,r,...] [--crop c,c,...] [--block N] [--verify] [--csv]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    Bench bench;
+    bool verify = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+
+        if (!strcmp(arg, "--csv"))
+        {
+            bench.csv = true;
+            continue;
+        }
+        if (!strcmp(arg, "--verify"))
+        {
+            verify = true;
+            continue;
+        }
+        if (!value)
+            usage();
+        i++;
+
+        if (!strcmp(arg, "--samples"))
+        {
+            bench.samples = atol(value);
+        }
+        else if (!strcmp(arg, "--engine"))
+        {
+            for (const std::string &name : split(value))
+            {
+                const Engine *found = nullptr;
+                for (const Engine &engine : ENGINES)
+                    if (name == engine.name)
+                        found = &engine;
+                if (!found)
+                    usage();
+                bench.engines.push_back(found);
+            }
+        }
+        else if (!strcmp(arg, "--spread"))
+        {
+            bench.spreads.clear();
+            if (!strcmp(value, "all"))
+                for (int r = 0; r <= 64; r++)
+                    bench.spreads.push_back(r);
+            else
+                for (const std::string &r : split(value))
+                    bench.spreads.push_back(clamp(atoi(r.c_str()), 0, 64));
+        }
+        else if (!strcmp(arg, "--block"))
+        {
+            bench.block = atoi(value);
+            // must divide the noise table, see steps()
+            if (bench.block < 1 || bench.block > NOISE_LENGTH || NOISE_LENGTH % bench.block)
+                usage();
+        }
+        else if (!strcmp(arg, "--crop"))
+        {
+            bench.crops.clear();
+            for (const std::string &c : split(value))
+                bench.crops.push_back(clamp(float(atof(c.c_str())), 0.f, 1.f));
+        }
+        else
+            usage();
+    }
+
+    if (bench.samples < 1)
+        usage();
+
+    // the float engines unless asked for others
+    if (bench.engines.empty())
+        for (const Engine &engine : ENGINES)
+            if (engine.format == FLOAT_SAMPLES)
+                bench.engines.push_back(&engine);
+
+    if (verify)
+        return bench.verifyAll();
+
+    bench.runAll();
+    return 0;
+}
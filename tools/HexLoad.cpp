@@ -0,0 +1,318 @@
+#include "Headless.hpp"
+#include "../src/HexEngine.hpp"
+#include "Perf.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/*
+    Patch-scale load test. Creates N HexNut and HexaGrain engines and steps
+    them on M threads the way Rack's engine does: every frame, each thread
+    claims modules from a shared atomic index until none are left, then all
+    threads meet at a barrier before the next frame.
+
+    Runs once per thread count and reports throughput, scaling against one
+    thread, per-thread CPU time, and estimated memory bandwidth from last
+    level cache misses where the kernel exposes them.
+
+    usage: hexload [--hexnut N] [--hexagrain N] [--threads M | m,m,...]
+                   [--seconds S] [--spread R] [--control N] [--rate HZ]
+                   [--storage float|fixed|half]
+*/
+
+static const int NOISE_LENGTH = 4096;
+static const int CACHE_LINE = 64;
+
+struct Instance
+{
+    std::unique_ptr<Hex> hex;
+    HexEngine engine = HexEngine(nullptr);
+    HexControls controls;
+    const float *noise;
+    float sink = 0;
+    int phase;
+    int controlDivision;
+    long clock = 0;
+
+    Instance(bool grain, SampleFormat format, int spread, int controlDivision, const float *noise, int seed)
+        : noise(noise), phase(seed * 97), controlDivision(controlDivision)
+    {
+        hex.reset(grain ? createStoredGrainHex(HEXAGRAIN_RADIUS, format) : createStoredHex(HEXNUT_RADIUS, format));
+        engine.hex = hex.get();
+
+        // spread instances over the parameter space, as a real patch would
+        controls.writeX = 1.f;
+        controls.readX = .5f + .05f * (seed % 7);
+        controls.readY = .1f * (seed % 3);
+        controls.readMode = 1 + seed % 3;
+        controls.writeRadius = controls.readRadius = .5f;
+        controls.blend = .8f;
+        controls.readRing = spread;
+    }
+
+    // as HexNut::process does it, controls at control rate and smoothed audio
+    void step()
+    {
+        if (clock++ % controlDivision == 0)
+            engine.setControls(controls, controlDivision);
+        sink += engine.process(noise[phase++ & (NOISE_LENGTH - 1)]);
+    }
+
+    size_t bytes()
+    {
+        size_t size = hex->length * sizeof(float) + sizeof(ActivityChannel);
+        if (GrainHex *grainHex = dynamic_cast<GrainHex *>(hex.get()))
+            size += grainHex->grainBytes();
+        return size;
+    }
+};
+
+// Spin, then yield, like Rack's hybrid engine barrier
+struct Barrier
+{
+    int total;
+    std::atomic<int> count;
+    std::atomic<unsigned> generation;
+
+    Barrier(int total) : total(total), count(0), generation(0)
+    {
+    }
+
+    // the last thread to arrive runs onLast before releasing the others
+    template <typename F>
+    void wait(F onLast)
+    {
+        unsigned g = generation;
+        if (count.fetch_add(1) + 1 == total)
+        {
+            onLast();
+            count = 0;
+            generation++;
+            return;
+        }
+
+        for (int spins = 0; generation == g; spins++)
+        {
+            if (spins < 1024)
+            {
+#if defined(__x86_64__) || defined(__i386__)
+                _mm_pause();
+#endif
+            }
+            else
+                std::this_thread::yield();
+        }
+    }
+};
+
+struct ThreadStats
+{
+    double cpuSeconds = 0;
+    long modules = 0;
+    uint64_t llcMisses = 0;
+    bool counters = false;
+};
+
+static double threadCpuSeconds()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+struct LoadTest
+{
+    int hexnuts = 10;
+    int hexagrains = 10;
+    std::vector<int> threadCounts;
+    double seconds = 2;
+    int spread = 0;
+    SampleFormat format = FLOAT_SAMPLES;
+    int controlDivision = 16;
+    float rate = 48000;
+
+    std::vector<float> noise;
+    std::vector<std::unique_ptr<Instance>> instances;
+
+    void build()
+    {
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<float> dist(-5.f, 5.f);
+        noise.resize(NOISE_LENGTH);
+        for (float &v : noise)
+            v = dist(rng);
+
+        for (int i = 0; i < hexnuts + hexagrains; i++)
+            instances.push_back(std::unique_ptr<Instance>(new Instance(i >= hexnuts, format, spread, controlDivision, noise.data(), i)));
+    }
+
+    // steps every instance for `frames` frames on `threads` threads
+    double run(int threads, long frames, std::vector<ThreadStats> &stats)
+    {
+        int count = instances.size();
+        std::atomic<int> index(0);
+        Barrier frameEnd(threads);
+
+        stats.assign(threads, ThreadStats());
+
+        auto worker = [&](int id)
+        {
+            ThreadStats &s = stats[id];
+            PerfCounter llc(PerfCounter::LLC_LOAD_MISSES);
+            double cpuStart = threadCpuSeconds();
+            llc.start();
+
+            for (long frame = 0; frame < frames; frame++)
+            {
+                for (int i; (i = index++) < count;)
+                {
+                    instances[i]->step();
+                    s.modules++;
+                }
+
+                frameEnd.wait([&]()
+                              { index = 0; });
+            }
+
+            s.llcMisses = llc.stop();
+            s.counters = llc.valid();
+            s.cpuSeconds = threadCpuSeconds() - cpuStart;
+        };
+
+        auto start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> pool;
+        for (int id = 1; id < threads; id++)
+            pool.push_back(std::thread(worker, id));
+        worker(0);
+        for (std::thread &thread : pool)
+            thread.join();
+
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void runAll()
+    {
+        build();
+
+        long frames = long(seconds * rate);
+        std::vector<ThreadStats> stats;
+
+        // warm the buffers so the first run isn't charged for page faults,
+        // and so grains have taken the blocks they need
+        run(1, std::min(frames, long(rate / 10)), stats);
+
+        size_t bytes = 0;
+        for (auto &instance : instances)
+            bytes += instance->bytes();
+
+        printf("%d HexNut + %d HexaGrain instances, spread %d, control every %d samples, %.0f Hz, %.1f MB of buffers, %u hardware threads\n\n",
+               hexnuts, hexagrains, spread, controlDivision, rate, bytes / 1e6, std::thread::hardware_concurrency());
+
+        printf("%7s %10s %12s %8s %10s %9s %s\n", "threads", "wall s", "frames/s", "x real", "speedup", "effic.", "per thread cpu% / modules / est. MB/s");
+
+        double baseline = 0;
+        for (int threads : threadCounts)
+        {
+            double elapsed = run(threads, frames, stats);
+            double fps = frames / elapsed;
+            if (baseline == 0)
+                baseline = fps / threads;
+
+            double speedup = fps / baseline;
+            printf("%7d %10.3f %12.0f %8.2f %10.2f %8.0f%%  ", threads, elapsed, fps, fps / rate, speedup, 100 * speedup / threads);
+
+            for (const ThreadStats &s : stats)
+            {
+                printf(" [%.0f%% %ld ", 100 * s.cpuSeconds / elapsed, s.modules);
+                if (s.counters)
+                    printf("%.0f]", s.llcMisses * CACHE_LINE / elapsed / 1e6);
+                else
+                    printf("n/a]");
+            }
+            printf("\n");
+            fflush(stdout);
+        }
+
+        // keep the engine output observable so the work isn't optimized away
+        volatile float sink = 0;
+        for (auto &instance : instances)
+            sink = sink + instance->sink;
+    }
+};
+
+static void usage()
+{
+    fprintf(stderr, "usage: hexload [--hexnut N] [--hexagrain N] [--threads M | m,m,...] [--seconds S] [--spread R] [--control N] [--rate HZ] [--storage float|fixed|half]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    LoadTest test;
+    int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 >= argc)
+            usage();
+        std::string arg = argv[i];
+        const char *value = argv[++i];
+
+        if (arg == "--hexnut")
+            test.hexnuts = std::max(0, atoi(value));
+        else if (arg == "--hexagrain")
+            test.hexagrains = std::max(0, atoi(value));
+        else if (arg == "--seconds")
+            test.seconds = atof(value);
+        else if (arg == "--spread")
+            test.spread = clamp(atoi(value), 0, 64);
+        else if (arg == "--control")
+            test.controlDivision = std::max(1, atoi(value));
+        else if (arg == "--rate")
+            test.rate = atof(value);
+        else if (arg == "--storage")
+        {
+            if (!storageNamed(value, test.format))
+                usage();
+        }
+        else if (arg == "--threads")
+        {
+            if (strchr(value, ','))
+            {
+                for (const char *p = value; p; p = strchr(p, ','), p = p ? p + 1 : p)
+                    test.threadCounts.push_back(std::max(1, atoi(p)));
+            }
+            else
+                maxThreads = std::max(1, atoi(value));
+        }
+        else
+            usage();
+    }
+
+    if (test.hexnuts + test.hexagrains == 0 || test.seconds <= 0 || test.rate <= 0)
+        usage();
+
+    // by default, double the thread count up to the limit
+    if (test.threadCounts.empty())
+    {
+        for (int threads = 1; threads < maxThreads; threads *= 2)
+            test.threadCounts.push_back(threads);
+        test.threadCounts.push_back(maxThreads);
+    }
+
+    test.runAll();
+    return 0;
+}
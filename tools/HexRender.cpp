@@ -0,0 +1,487 @@
+#include "Headless.hpp"
+#include "../src/HexEngine.hpp"
+#include "../src/Wav.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <fstream>
+#include <string>
+#include <thread>
+
+/*
+    Renders WAV files through the HexNut or HexaGrain engine, faster than real
+    time and in parallel across cores. Every input is rendered once per script
+    and per sweep step, and each channel gets its own engine, as if it were
+    patched into its own module.
+
+    usage: hexrender [options] input.wav...
+
+        -o, --out DIR                 output directory (default .)
+        --engine hexnut|hexagrain     engine to render with (default hexnut)
+        --storage float|fixed|half    sample storage (default float)
+        --script FILE                 automation script, repeat for variations
+        --set NAME=VALUE              fixed control value
+        --sweep NAME=FROM:TO:STEPS    one variation per step
+        --tail SECONDS                keep rendering after the input ends
+        --heads N                     read heads per channel (default 1)
+        --drift AMOUNT                read x offset between channels, as between voices
+        --jobs N                      worker threads (default all cores)
+
+    Scripts hold one breakpoint per line, as `seconds control value`. Values
+    ramp linearly between breakpoints of the same control and hold outside
+    them. They are sampled every HEX_BLOCK_SIZE frames and the engine ramps
+    between samples, as the modules do at their control rate. Lines starting
+    with # are comments.
+*/
+
+// Rack's audio convention, 5V is full scale
+static const float VOLTS = 5.f;
+
+struct Control
+{
+    const char *name;
+    float HexControls::*member;
+};
+
+static const Control CONTROLS[] = {
+    {"write_mode", &HexControls::writeMode},
+    {"read_mode", &HexControls::readMode},
+    {"write_radius", &HexControls::writeRadius},
+    {"read_radius", &HexControls::readRadius},
+    {"grain_size", &HexControls::grainSize},
+    {"write_x", &HexControls::writeX},
+    {"write_y", &HexControls::writeY},
+    {"write_z", &HexControls::writeZ},
+    {"read_x", &HexControls::readX},
+    {"read_y", &HexControls::readY},
+    {"read_z", &HexControls::readZ},
+    {"blend", &HexControls::blend},
+    {"spread", &HexControls::readRing},
+    {"crop", &HexControls::crop},
+};
+
+static const int CONTROLS_LEN = sizeof(CONTROLS) / sizeof(CONTROLS[0]);
+
+static int findControl(const std::string &name)
+{
+    for (int i = 0; i < CONTROLS_LEN; i++)
+        if (name == CONTROLS[i].name)
+            return i;
+    return -1;
+}
+
+static std::string stem(const std::string &path)
+{
+    size_t slash = path.find_last_of("/\\");
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    return dot == std::string::npos ? name : name.substr(0, dot);
+}
+
+struct Lane
+{
+    struct Point
+    {
+        double time;
+        float value;
+    };
+
+    std::vector<Point> points;
+    size_t index = 0;
+
+    // times only move forward while rendering, so walk the points once
+    float valueAt(double time)
+    {
+        while (index + 1 < points.size() && points[index + 1].time <= time)
+            index++;
+
+        const Point &a = points[index];
+        if (index + 1 == points.size() || time <= a.time)
+            return a.value;
+
+        const Point &b = points[index + 1];
+        double t = (time - a.time) / (b.time - a.time);
+        return a.value + (b.value - a.value) * t;
+    }
+};
+
+struct Script
+{
+    std::string name;
+    Lane lanes[CONTROLS_LEN];
+
+    bool load(const std::string &path, std::string &error)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            error = "cannot open " + path;
+            return false;
+        }
+
+        name = stem(path);
+
+        std::string line;
+        for (int number = 1; std::getline(file, line); number++)
+        {
+            size_t start = line.find_first_not_of(" \t\r");
+            if (start == std::string::npos || line[start] == '#')
+                continue;
+
+            std::istringstream fields(line);
+            double time;
+            std::string control;
+            float value;
+            if (!(fields >> time >> control >> value))
+            {
+                error = path + ":" + std::to_string(number) + ": expected `seconds control value`";
+                return false;
+            }
+
+            int id = findControl(control);
+            if (id < 0)
+            {
+                error = path + ":" + std::to_string(number) + ": unknown control " + control;
+                return false;
+            }
+
+            std::vector<Lane::Point> &points = lanes[id].points;
+            Lane::Point point = {time, value};
+            auto at = std::upper_bound(points.begin(), points.end(), point,
+                                       [](const Lane::Point &a, const Lane::Point &b)
+                                       { return a.time < b.time; });
+            points.insert(at, point);
+        }
+
+        return true;
+    }
+};
+
+struct Setting
+{
+    int control;
+    float value;
+};
+
+struct Job
+{
+    const Wav *input;
+    std::string inputName;
+    const Script *script;
+    std::vector<Setting> settings;
+    std::string path;
+};
+
+struct Renderer
+{
+    bool grain = false;
+    SampleFormat format = FLOAT_SAMPLES;
+    double tail = 0;
+    int heads = 1;
+    float drift = 0;
+
+    // one engine per channel, like a module per channel
+    Wav render(const Job &job)
+    {
+        const Wav &in = *job.input;
+
+        Wav out;
+        out.channels = in.channels;
+        out.sampleRate = in.sampleRate;
+
+        int inFrames = in.frames();
+        int frames = inFrames + int(tail * in.sampleRate);
+        out.samples.resize(size_t(frames) * out.channels);
+
+        double sampleTime = 1.0 / in.sampleRate;
+
+        for (int channel = 0; channel < in.channels; channel++)
+        {
+            std::unique_ptr<Hex> hex(grain ? createStoredGrainHex(HEXAGRAIN_RADIUS, format) : createStoredHex(HEXNUT_RADIUS, format));
+            HexEngine engine(hex.get());
+            engine.setHeads(heads - 1);
+            engine.readDrift = HexEngine::voiceDrift(channel, drift);
+
+            HexControls c;
+            for (const Setting &setting : job.settings)
+                c.*CONTROLS[setting.control].member = setting.value;
+
+            Script script;
+            if (job.script)
+                script = *job.script;
+
+            std::vector<int> automated;
+            for (int id = 0; id < CONTROLS_LEN; id++)
+                if (!script.lanes[id].points.empty())
+                    automated.push_back(id);
+
+            // automation is sampled once per block, and ramped to by the next.
+            // Blocks without automation run on the block kernels.
+            float samples[HEX_BLOCK_SIZE];
+            for (int start = 0; start < frames; start += HEX_BLOCK_SIZE)
+            {
+                int n = std::min(frames - start, HEX_BLOCK_SIZE);
+
+                if (start == 0 || !automated.empty())
+                {
+                    for (int id : automated)
+                        c.*CONTROLS[id].member = script.lanes[id].valueAt(start * sampleTime);
+                    engine.setControls(c, HEX_BLOCK_SIZE);
+                }
+
+                for (int i = 0; i < n; i++)
+                {
+                    int frame = start + i;
+                    samples[i] = frame < inFrames ? in.samples[size_t(frame) * in.channels + channel] * VOLTS : 0.f;
+                }
+                engine.process(samples, samples, n);
+                for (int i = 0; i < n; i++)
+                    out.samples[size_t(start + i) * out.channels + channel] = samples[i] / VOLTS;
+            }
+        }
+
+        return out;
+    }
+};
+
+static void usage()
+{
+    fprintf(stderr,
+            "usage: hexrender [options] input.wav...\n"
+            "  -o, --out DIR                 output directory (default .)\n"
+            "  --engine hexnut|hexagrain     engine to render with (default hexnut)\n"
+            "  --storage float|fixed|half    sample storage (default float)\n"
+            "  --script FILE                 automation script, repeat for variations\n"
+            "  --set NAME=VALUE              fixed control value\n"
+            "  --sweep NAME=FROM:TO:STEPS    one variation per step\n"
+            "  --tail SECONDS                keep rendering after the input ends\n"
+            "  --heads N                     read heads per channel (default 1)\n"
+            "  --drift AMOUNT                read x offset between channels, as between voices\n"
+            "  --jobs N                      worker threads (default all cores)\n"
+            "controls:");
+    for (const Control &control : CONTROLS)
+        fprintf(stderr, " %s", control.name);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+static void fail(const std::string &error)
+{
+    fprintf(stderr, "hexrender: %s\n", error.c_str());
+    exit(1);
+}
+
+static Setting parseSetting(const std::string &arg, std::string &rest)
+{
+    size_t eq = arg.find('=');
+    if (eq == std::string::npos)
+        usage();
+
+    Setting setting;
+    setting.control = findControl(arg.substr(0, eq));
+    if (setting.control < 0)
+        fail("unknown control " + arg.substr(0, eq));
+
+    rest = arg.substr(eq + 1);
+    setting.value = atof(rest.c_str());
+    return setting;
+}
+
+int main(int argc, char **argv)
+{
+    Renderer renderer;
+    std::string outDir = ".";
+    int threads = std::thread::hardware_concurrency();
+
+    std::vector<std::string> inputPaths;
+    std::vector<Script> scripts;
+    std::vector<Setting> settings;
+    std::vector<std::vector<Setting>> sweeps;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg[0] != '-')
+        {
+            inputPaths.push_back(arg);
+            continue;
+        }
+        if (i + 1 >= argc)
+            usage();
+        std::string value = argv[++i];
+        std::string error;
+
+        if (arg == "-o" || arg == "--out")
+        {
+            outDir = value;
+        }
+        else if (arg == "--engine")
+        {
+            if (value != "hexnut" && value != "hexagrain")
+                usage();
+            renderer.grain = value == "hexagrain";
+        }
+        else if (arg == "--storage")
+        {
+            if (!storageNamed(value, renderer.format))
+                usage();
+        }
+        else if (arg == "--script")
+        {
+            scripts.push_back(Script());
+            if (!scripts.back().load(value, error))
+                fail(error);
+        }
+        else if (arg == "--set")
+        {
+            std::string rest;
+            settings.push_back(parseSetting(value, rest));
+        }
+        else if (arg == "--sweep")
+        {
+            std::string rest;
+            Setting setting = parseSetting(value, rest);
+
+            float from, to;
+            int steps;
+            if (sscanf(rest.c_str(), "%f:%f:%d", &from, &to, &steps) != 3 || steps < 1)
+                fail("sweep expects NAME=FROM:TO:STEPS, got " + value);
+
+            std::vector<Setting> sweep;
+            for (int step = 0; step < steps; step++)
+            {
+                setting.value = steps == 1 ? from : from + (to - from) * step / (steps - 1);
+                sweep.push_back(setting);
+            }
+            sweeps.push_back(sweep);
+        }
+        else if (arg == "--tail")
+        {
+            renderer.tail = std::max(0.0, atof(value.c_str()));
+        }
+        else if (arg == "--heads")
+        {
+            renderer.heads = clamp(atoi(value.c_str()), 1, MAX_READ_HEADS);
+        }
+        else if (arg == "--drift")
+        {
+            renderer.drift = atof(value.c_str());
+        }
+        else if (arg == "--jobs")
+        {
+            threads = atoi(value.c_str());
+        }
+        else
+            usage();
+    }
+
+    if (inputPaths.empty())
+        usage();
+
+    std::vector<Wav> inputs(inputPaths.size());
+    for (size_t i = 0; i < inputPaths.size(); i++)
+    {
+        std::string error;
+        if (!inputs[i].load(inputPaths[i], error))
+            fail(error);
+    }
+
+    // every input, times every script, times every combination of sweep steps
+
+    std::vector<Job> jobs;
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+        Job job;
+        job.input = &inputs[i];
+        job.inputName = stem(inputPaths[i]);
+        job.script = nullptr;
+        job.settings = settings;
+        job.path = job.inputName;
+        jobs.push_back(job);
+    }
+
+    if (!scripts.empty())
+    {
+        std::vector<Job> scripted;
+        for (const Job &job : jobs)
+            for (const Script &script : scripts)
+            {
+                Job variation = job;
+                variation.script = &script;
+                variation.path += "_" + script.name;
+                scripted.push_back(variation);
+            }
+        jobs.swap(scripted);
+    }
+
+    for (const std::vector<Setting> &sweep : sweeps)
+    {
+        std::vector<Job> swept;
+        for (const Job &job : jobs)
+            for (const Setting &setting : sweep)
+            {
+                char suffix[64];
+                snprintf(suffix, sizeof(suffix), "_%s%g", CONTROLS[setting.control].name, setting.value);
+
+                Job variation = job;
+                variation.settings.push_back(setting);
+                variation.path += suffix;
+                swept.push_back(variation);
+            }
+        jobs.swap(swept);
+    }
+
+    for (Job &job : jobs)
+        job.path = outDir + "/" + job.path + ".wav";
+
+    threads = clamp(threads, 1, int(jobs.size()));
+
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    std::mutex logMutex;
+    double audioSeconds = 0;
+
+    auto start = std::chrono::steady_clock::now();
+
+    auto worker = [&]()
+    {
+        for (size_t i; (i = next++) < jobs.size();)
+        {
+            const Job &job = jobs[i];
+            Wav out = renderer.render(job);
+
+            std::string error;
+            bool ok = out.save(job.path, error);
+
+            std::lock_guard<std::mutex> lock(logMutex);
+            if (ok)
+            {
+                audioSeconds += double(out.frames()) / out.sampleRate * out.channels;
+                fprintf(stderr, "[%zu/%zu] %s\n", i + 1, jobs.size(), job.path.c_str());
+            }
+            else
+            {
+                fprintf(stderr, "hexrender: %s\n", error.c_str());
+                failed = true;
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int i = 0; i < threads; i++)
+        pool.push_back(std::thread(worker));
+    for (std::thread &thread : pool)
+        thread.join();
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    fprintf(stderr, "rendered %zu files, %.1f s of channel audio in %.2f s (%.1fx real time) on %d threads\n",
+            jobs.size(), audioSeconds, elapsed, audioSeconds / elapsed, threads);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,139 @@
+#include "Headless.hpp"
+#include "../src/HexEngine.hpp"
+#include "../src/ReadHeads.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+/*
+    Startup cost of each module's engines. Builds the hexes, engines and read
+    heads that the HexNut and HexaGrain constructors build, N at a time, and
+    reports the time to make the first one, which lays out its radius, the
+    time per instance after that, and the memory each instance holds.
+
+    Rack's own work in config() and the widgets isn't included, only what
+    this plugin adds to it. --voices N also makes the hexes for N voices, as
+    a HexNut does once a polyphonic cable brings them in.
+
+    usage: hexstart [--count N] [--voices N]
+*/
+
+static const int PORT_MAX_CHANNELS = 16;
+
+// the engine side of one module, as HexNut's constructor leaves it
+struct ModuleEngines
+{
+    std::vector<std::unique_ptr<Hex>> voiceHexes;
+    std::vector<HexEngine> engines;
+    std::vector<ReadHeads> voiceHeads;
+
+    ModuleEngines(int maxVoices, bool grain, int voices)
+    {
+        engines.assign(maxVoices, HexEngine(nullptr));
+        voiceHeads.resize(maxVoices);
+        voiceHexes.reserve(maxVoices);
+        for (int v = 0; v < voices; v++)
+        {
+            voiceHexes.push_back(std::unique_ptr<Hex>(grain ? createStoredGrainHex(HEXAGRAIN_RADIUS, FLOAT_SAMPLES) : createStoredHex(HEXNUT_RADIUS, FLOAT_SAMPLES)));
+            engines[v].hex = voiceHexes.back().get();
+        }
+    }
+
+    size_t bytes()
+    {
+        size_t size = engines.size() * sizeof(HexEngine) + voiceHeads.size() * sizeof(ReadHeads);
+        for (auto &hex : voiceHexes)
+        {
+            size += sizeof(*hex) + hex->length * (sizeof(float) + sizeof(uint16_t));
+            if (GrainHex *grainHex = dynamic_cast<GrainHex *>(hex.get()))
+                size += grainHex->grainBytes();
+        }
+        return size;
+    }
+};
+
+// resident memory of the process, or 0 where it can't be read
+static size_t residentBytes()
+{
+#ifdef __linux__
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (!statm)
+        return 0;
+    long pages = 0, resident = 0;
+    int read = fscanf(statm, "%ld %ld", &pages, &resident);
+    fclose(statm);
+    return read == 2 ? resident * sysconf(_SC_PAGESIZE) : 0;
+#else
+    return 0;
+#endif
+}
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void measure(const char *name, int maxVoices, bool grain, int voices, int count)
+{
+    std::vector<std::unique_ptr<ModuleEngines>> modules;
+    modules.reserve(count);
+
+    size_t residentBefore = residentBytes();
+
+    auto start = std::chrono::steady_clock::now();
+    modules.push_back(std::unique_ptr<ModuleEngines>(new ModuleEngines(maxVoices, grain, voices)));
+    double first = millisecondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 1; i < count; i++)
+        modules.push_back(std::unique_ptr<ModuleEngines>(new ModuleEngines(maxVoices, grain, voices)));
+    double rest = count > 1 ? millisecondsSince(start) / (count - 1) : 0;
+
+    size_t residentAfter = residentBytes();
+
+    printf("%-10s %6d %6d %10.3f %10.3f %12.1f", name, voices, count, first, rest, modules[0]->bytes() / 1024.0);
+    if (residentAfter > residentBefore)
+        printf(" %12.1f\n", (residentAfter - residentBefore) / 1024.0 / count);
+    else
+        printf(" %12s\n", "n/a");
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: hexstart [--count N] [--voices N]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int count = 32;
+    int voices = 1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 >= argc)
+            usage();
+        std::string arg = argv[i];
+        const char *value = argv[++i];
+
+        if (arg == "--count")
+            count = std::max(1, atoi(value));
+        else if (arg == "--voices")
+            voices = clamp(atoi(value), 1, PORT_MAX_CHANNELS);
+        else
+            usage();
+    }
+
+    printf("%-10s %6s %6s %10s %10s %12s %12s\n", "module", "voices", "count", "first ms", "each ms", "held KB", "resident KB");
+
+    measure("HexNut", PORT_MAX_CHANNELS, false, voices, count);
+    measure("HexaGrain", 1, true, 1, count);
+    return 0;
+}